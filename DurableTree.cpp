@@ -0,0 +1,880 @@
+#pragma once
+#include "RBTree.cpp"
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <stdexcept>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// @brief how keys and values are written to the log and checkpoints.
+/// trivially copyable types are copied as bytes,specialize it for other types
+template <typename T>
+struct LogCodec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "LogCodec: specialize it for types that are not trivially copyable");
+
+    static void Encode(std::string &out, const T &value)
+    {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    static bool Decode(const char *&p, const char *end, T &value)
+    {
+        if (end - p < static_cast<std::ptrdiff_t>(sizeof(T)))
+        {
+            return false;
+        }
+        std::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+};
+
+template <>
+struct LogCodec<std::string>
+{
+    static void Encode(std::string &out, const std::string &value)
+    {
+        LogCodec<std::uint32_t>::Encode(out, static_cast<std::uint32_t>(value.size()));
+        out.append(value);
+    }
+
+    static bool Decode(const char *&p, const char *end, std::string &value)
+    {
+        std::uint32_t size = 0;
+        if (!LogCodec<std::uint32_t>::Decode(p, end, size) || end - p < static_cast<std::ptrdiff_t>(size))
+        {
+            return false;
+        }
+        value.assign(p, size);
+        p += size;
+        return true;
+    }
+};
+
+/// @brief options of DurableTree
+struct DurableOptions
+{
+    // how long a commit waits for other writers to share its fsync,0 syncs at once
+    std::chrono::microseconds groupCommitDelay = std::chrono::microseconds(1000);
+    // a batch this large is synced without waiting out the delay
+    std::size_t maxBatchBytes = 1 << 20;
+    // take a checkpoint after this many logged operations,0 only on Checkpoint()
+    std::size_t checkpointEvery = 100000;
+    // keys a checkpoint copies per hold of the tree's lock,readers and writers
+    // wait at most that long for it. 0 copies the whole tree at once
+    std::size_t checkpointChunk = 4096;
+};
+
+/// @brief append-only file with explicit sync
+class LogFile
+{
+private:
+    int fd;
+
+public:
+    LogFile() : fd(-1)
+    {
+    }
+
+    ~LogFile()
+    {
+        Close();
+    }
+
+    LogFile(const LogFile &) = delete;
+    LogFile &operator=(const LogFile &) = delete;
+
+    bool Open(const std::string &path)
+    {
+#ifdef _WIN32
+        fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, 0644);
+#else
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+        return fd >= 0;
+    }
+
+    bool Write(const std::string &data)
+    {
+        const char *p = data.data();
+        std::size_t left = data.size();
+        while (left > 0)
+        {
+#ifdef _WIN32
+            int written = _write(fd, p, static_cast<unsigned>(left));
+#else
+            ssize_t written = ::write(fd, p, left);
+#endif
+            if (written <= 0)
+            {
+                return false;
+            }
+            p += written;
+            left -= written;
+        }
+        return true;
+    }
+
+    bool Sync()
+    {
+#ifdef _WIN32
+        return _commit(fd) == 0;
+#else
+        return ::fsync(fd) == 0;
+#endif
+    }
+
+    bool Truncate(std::uint64_t size)
+    {
+#ifdef _WIN32
+        return _chsize_s(fd, static_cast<long long>(size)) == 0;
+#else
+        return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    void Close()
+    {
+        if (fd >= 0)
+        {
+#ifdef _WIN32
+            _close(fd);
+#else
+            ::close(fd);
+#endif
+            fd = -1;
+        }
+    }
+
+    /// @brief rename from to to,made durable before it returns
+    static bool Rename(const std::string &from, const std::string &to)
+    {
+#ifdef _WIN32
+        std::remove(to.c_str());
+#endif
+        if (std::rename(from.c_str(), to.c_str()) != 0)
+        {
+            return false;
+        }
+#ifndef _WIN32
+        std::string dir = to.substr(0, to.find_last_of('/') + 1);
+        int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+        if (dirFd >= 0)
+        {
+            ::fsync(dirFd);
+            ::close(dirFd);
+        }
+#endif
+        return true;
+    }
+
+    /// @brief write parts one after another to path through a temporary file,
+    /// synced before it replaces path
+    static bool Replace(const std::string &path, const std::vector<std::string> &parts)
+    {
+        std::string tmp = path + ".tmp";
+        std::remove(tmp.c_str());
+        LogFile file;
+        if (!file.Open(tmp))
+        {
+            return false;
+        }
+        for (const std::string &part : parts)
+        {
+            if (!file.Write(part))
+            {
+                return false;
+            }
+        }
+        if (!file.Sync())
+        {
+            return false;
+        }
+        file.Close();
+        return Rename(tmp, path);
+    }
+
+    /// @brief whole file,empty when it doesn't exist
+    static std::string ReadAll(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // FNV-1a,detects torn or corrupted records. pass the previous result as hash
+    // to go on over data in several pieces
+    static std::uint32_t Checksum(const char *p, std::size_t size, std::uint32_t hash = 2166136261u)
+    {
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ static_cast<unsigned char>(p[i])) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+/// @brief RBTree that logs every Insert/Update/Delete to <path>.log before returning.
+/// writers arriving within groupCommitDelay share one fsync,
+/// checkpoints are copied a chunk at a time between commits and go to <path>.ckpt,
+/// the log they cover is set aside as <path>.log.old and removed once it is written.
+/// the constructor recovers from the last checkpoint plus the log tail.
+/// other threads see a change while it waits for its fsync; when the log fails,
+/// every change not on disk yet is rolled back and its caller gets the exception.
+/// all members are thread-safe
+/// @tparam K,V : need a LogCodec
+template <typename K, typename V>
+class DurableTree
+{
+private:
+    enum Op : std::uint8_t
+    {
+        OpInsert,
+        OpDelete
+    };
+
+    // a checkpoint is copied by the flusher a chunk per round,then written by
+    // imageWriter while commits go on
+    enum Phase : std::uint8_t
+    {
+        Idle,
+        Copying,
+        Writing
+    };
+
+    RBTree<K, V> tree;
+    std::string path;
+    DurableOptions options;
+    LogFile log;
+
+    // guards everything below and tree
+    std::mutex mutex;
+    // wakes the flusher
+    std::condition_variable flushWanted;
+    // wakes writers waiting for their sequence number
+    std::condition_variable flushed;
+    // encoded records not yet written
+    std::string pending;
+    // last sequence number given out / synced / covered by a checkpoint
+    std::uint64_t appendedSeq = 0;
+    std::uint64_t durableSeq = 0;
+    std::uint64_t checkpointSeq = 0;
+    std::size_t sinceCheckpoint = 0;
+    bool checkpointWanted = false;
+    // checkpoints that began / that finished
+    std::uint64_t checkpointsTaken = 0;
+    std::uint64_t checkpointsWritten = 0;
+    // the log failed,set by the flusher once it rolled back what wasn't on disk
+    bool failed = false;
+    // imageWriter couldn't write the checkpoint,the flusher fails the log then
+    bool imageFailed = false;
+
+    // what a record not on disk yet replaced,undone newest first when the log fails
+    struct Undo
+    {
+        std::uint64_t seq;
+        K key;
+        bool existed;
+        V value;
+    };
+    std::deque<Undo> undo;
+    bool stopping = false;
+    std::thread flusher;
+
+    Phase phase = Idle;
+    std::thread imageWriter;
+    // bytes of <path>.log known to be synced,only the flusher uses it
+    std::uint64_t logSize = 0;
+
+    // owned by the flusher while Copying,by imageWriter while Writing:
+    // the checkpoint in pieces (one per chunk,so it is never copied as it grows),
+    // its sequence number,the key copied last and the newest record a copied
+    // value may come from
+    std::vector<std::string> image;
+    std::uint64_t imageSeq = 0;
+    std::uint64_t imageCount = 0;
+    K imageLast = K();
+    std::uint64_t imageNewest = 0;
+
+    // record: size,checksum,then seq,op,key[,value]
+    std::uint64_t _Append(Op op, const K &key, const V *value)
+    {
+        std::string body;
+        LogCodec<std::uint64_t>::Encode(body, ++appendedSeq);
+        LogCodec<std::uint8_t>::Encode(body, op);
+        LogCodec<K>::Encode(body, key);
+        if (value)
+        {
+            LogCodec<V>::Encode(body, *value);
+        }
+        LogCodec<std::uint32_t>::Encode(pending, static_cast<std::uint32_t>(body.size()));
+        LogCodec<std::uint32_t>::Encode(pending, LogFile::Checksum(body.data(), body.size()));
+        pending += body;
+        sinceCheckpoint++;
+        flushWanted.notify_one();
+        return appendedSeq;
+    }
+
+    void _CheckLog()
+    {
+        if (failed)
+        {
+            throw std::runtime_error("Write-ahead log of " + path + " failed");
+        }
+    }
+
+    // keep what key holds before the change about to be logged
+    void _Remember(const K &key)
+    {
+        bool existed = tree.Contain(key);
+        undo.push_back(Undo{appendedSeq + 1, key, existed, existed ? tree.Get(key) : V()});
+    }
+
+    // lock must hold mutex
+    void _WaitDurable(std::unique_lock<std::mutex> &lock, std::uint64_t seq)
+    {
+        flushed.wait(lock, [&] { return durableSeq >= seq || failed; });
+        if (durableSeq < seq)
+        {
+            throw std::runtime_error("Write-ahead log of " + path + " failed");
+        }
+    }
+
+    // the log can't be trusted any more: undo every change that isn't on disk,
+    // drop the records not written yet (and cut off any written only in part)
+    // and refuse writes from now on.
+    // only the flusher calls it,so no batch is being written meanwhile
+    void _Fail()
+    {
+        failed = true;
+        pending.clear();
+        log.Truncate(logSize);
+        for (auto it = undo.rbegin(); it != undo.rend(); ++it)
+        {
+            if (it->existed)
+            {
+                tree.Insert(it->key, it->value);
+            }
+            else
+            {
+                tree.Delete(it->key);
+            }
+        }
+        undo.clear();
+        checkpointWanted = false;
+        if (phase == Copying)
+        {
+            phase = Idle;
+            checkpointsWritten++;
+        }
+    }
+
+    // checkpoint: magic,seq,count,entries,checksum of all before it.
+    // it starts from the tree holding exactly the records up to seq,keys copied
+    // later may be newer. recovery replays every record after seq over it,and a
+    // record sets or removes a whole key,so the result is the same
+    void _BeginCheckpoint(std::uint64_t seq)
+    {
+        phase = Copying;
+        imageSeq = seq;
+        imageCount = 0;
+        image.assign(1, "RBCK");
+        LogCodec<std::uint64_t>::Encode(image[0], seq);
+        LogCodec<std::uint64_t>::Encode(image[0], 0);
+    }
+
+    // copy the next chunk of keys,lock must hold mutex. true once all are copied
+    bool _CopyChunk()
+    {
+        auto cursor = tree.GetCursor();
+        // the tree may have changed since the last chunk,go on after the last key copied
+        if (imageCount > 0 && cursor.Seek(imageLast))
+        {
+            cursor.Next();
+        }
+        image.emplace_back();
+        std::string &piece = image.back();
+        for (std::size_t i = 0; cursor.Valid() && (options.checkpointChunk == 0 || i < options.checkpointChunk); i++)
+        {
+            LogCodec<K>::Encode(piece, cursor.Key());
+            LogCodec<V>::Encode(piece, cursor.Value());
+            imageLast = cursor.Key();
+            imageCount++;
+            cursor.Next();
+        }
+        imageNewest = appendedSeq;
+        return !cursor.Valid();
+    }
+
+    // runs on imageWriter,so commits go on while the checkpoint is synced
+    void _WriteImage()
+    {
+        {
+            // the image must not hold changes the log may still lose (and roll back)
+            std::unique_lock<std::mutex> lock(mutex);
+            flushed.wait(lock, [&] { return durableSeq >= imageNewest || failed; });
+            if (durableSeq < imageNewest)
+            {
+                std::vector<std::string>().swap(image);
+                phase = Idle;
+                checkpointsWritten++;
+                flushed.notify_all();
+                return;
+            }
+        }
+
+        std::string count;
+        LogCodec<std::uint64_t>::Encode(count, imageCount);
+        image[0].replace(4 + sizeof(std::uint64_t), count.size(), count);
+        std::uint32_t checksum = LogFile::Checksum(nullptr, 0);
+        for (const std::string &piece : image)
+        {
+            checksum = LogFile::Checksum(piece.data(), piece.size(), checksum);
+        }
+        image.emplace_back();
+        LogCodec<std::uint32_t>::Encode(image.back(), checksum);
+
+        bool ok = LogFile::Replace(path + ".ckpt", image);
+        if (ok)
+        {
+            // every record in it is covered now,a crash before the removal only replays them
+            std::remove((path + ".log.old").c_str());
+        }
+        std::vector<std::string>().swap(image);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ok)
+        {
+            checkpointSeq = imageSeq;
+        }
+        else
+        {
+            imageFailed = true;
+        }
+        phase = Idle;
+        checkpointsWritten++;
+        flushed.notify_all();
+        // a checkpoint asked for meanwhile can begin now,or the failure be handled
+        flushWanted.notify_one();
+    }
+
+    // set the log with the records up to the checkpoint being copied aside,
+    // new records go to a fresh log
+    bool _RotateLog()
+    {
+        log.Close();
+        return LogFile::Rename(path + ".log", path + ".log.old") && log.Open(path + ".log");
+    }
+
+    // apply the records of one log,stop at the first torn record.
+    // records already applied (from the checkpoint or .log.old) are skipped.
+    // returns the length of the valid part
+    std::size_t _Replay(const std::string &data)
+    {
+        const char *p = data.data();
+        const char *end = p + data.size();
+        std::size_t valid = 0;
+        while (true)
+        {
+            std::uint32_t size = 0, checksum = 0;
+            if (!LogCodec<std::uint32_t>::Decode(p, end, size) ||
+                !LogCodec<std::uint32_t>::Decode(p, end, checksum) ||
+                end - p < static_cast<std::ptrdiff_t>(size) ||
+                checksum != LogFile::Checksum(p, size))
+            {
+                break;
+            }
+            const char *body = p;
+            const char *bodyEnd = p + size;
+            p = bodyEnd;
+            std::uint64_t seq = 0;
+            std::uint8_t op = 0;
+            K key;
+            V value;
+            if (!LogCodec<std::uint64_t>::Decode(body, bodyEnd, seq) ||
+                !LogCodec<std::uint8_t>::Decode(body, bodyEnd, op) ||
+                !LogCodec<K>::Decode(body, bodyEnd, key) ||
+                (op == OpInsert && !LogCodec<V>::Decode(body, bodyEnd, value)))
+            {
+                break;
+            }
+            valid = p - data.data();
+            if (seq <= appendedSeq)
+            {
+                continue;
+            }
+            if (op == OpInsert)
+            {
+                tree.Insert(key, value);
+            }
+            else
+            {
+                tree.Delete(key);
+            }
+            appendedSeq = durableSeq = seq;
+        }
+        return valid;
+    }
+
+    void _Recover()
+    {
+        std::string data = LogFile::ReadAll(path + ".ckpt");
+        if (!data.empty())
+        {
+            if (data.size() < 4 + 2 * sizeof(std::uint64_t) + sizeof(std::uint32_t) ||
+                data.compare(0, 4, "RBCK") != 0)
+            {
+                throw std::runtime_error("Checkpoint " + path + ".ckpt is corrupted");
+            }
+            const char *p = data.data() + 4;
+            const char *end = data.data() + data.size() - sizeof(std::uint32_t);
+            const char *tail = end;
+            std::uint32_t checksum = 0;
+            LogCodec<std::uint32_t>::Decode(tail, data.data() + data.size(), checksum);
+            if (checksum != LogFile::Checksum(data.data(), end - data.data()))
+            {
+                throw std::runtime_error("Checkpoint " + path + ".ckpt is corrupted");
+            }
+            std::uint64_t count = 0;
+            LogCodec<std::uint64_t>::Decode(p, end, checkpointSeq);
+            LogCodec<std::uint64_t>::Decode(p, end, count);
+            for (std::uint64_t i = 0; i < count; i++)
+            {
+                K key;
+                V value;
+                if (!LogCodec<K>::Decode(p, end, key) || !LogCodec<V>::Decode(p, end, value))
+                {
+                    throw std::runtime_error("Checkpoint " + path + ".ckpt is corrupted");
+                }
+                tree.Insert(key, value);
+            }
+        }
+        appendedSeq = durableSeq = checkpointSeq;
+
+        // a checkpoint that didn't finish leaves the log it covers aside
+        std::string old = LogFile::ReadAll(path + ".log.old");
+        old.resize(_Replay(old));
+        data = LogFile::ReadAll(path + ".log");
+        data.resize(_Replay(data));
+        if (!old.empty())
+        {
+            // the next checkpoint sets the log aside again,so join both first
+            if (!LogFile::Replace(path + ".log", {old, data}))
+            {
+                throw std::runtime_error("Can't rewrite write-ahead log " + path + ".log");
+            }
+            data.insert(0, old);
+        }
+        std::remove((path + ".log.old").c_str());
+
+        if (!log.Open(path + ".log") || !log.Truncate(data.size()))
+        {
+            throw std::runtime_error("Can't open write-ahead log " + path + ".log");
+        }
+        logSize = data.size();
+    }
+
+    void _Flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            // a wanted checkpoint only wakes the flusher once it can begin
+            flushWanted.wait(lock, [&]
+                             { return stopping || (checkpointWanted && phase == Idle && !failed) ||
+                                      (imageFailed && !failed) || phase == Copying || !pending.empty(); });
+            if (stopping && pending.empty())
+            {
+                // a checkpoint left half copied is dropped,the last one and the logs cover everything
+                lock.unlock();
+                if (imageWriter.joinable())
+                {
+                    imageWriter.join();
+                }
+                return;
+            }
+            // give other writers the latency budget to join this batch
+            if (!stopping && !checkpointWanted && phase != Copying && options.groupCommitDelay.count() > 0)
+            {
+                flushWanted.wait_for(lock, options.groupCommitDelay, [&]
+                                     { return stopping || pending.size() >= options.maxBatchBytes; });
+            }
+
+            std::string batch;
+            batch.swap(pending);
+            std::uint64_t seq = appendedSeq;
+            bool begin = phase == Idle && !failed &&
+                         (checkpointWanted || (options.checkpointEvery != 0 && sinceCheckpoint >= options.checkpointEvery));
+            if (begin)
+            {
+                // the last imageWriter is done with everything but returning
+                if (imageWriter.joinable())
+                {
+                    imageWriter.join();
+                }
+                _BeginCheckpoint(seq);
+                sinceCheckpoint = 0;
+                checkpointWanted = false;
+                checkpointsTaken++;
+            }
+            // one chunk per round,so writers get the lock back in between
+            bool copied = phase == Copying && _CopyChunk();
+            if (copied)
+            {
+                phase = Writing;
+            }
+            lock.unlock();
+
+            bool ok = batch.empty() || (log.Write(batch) && log.Sync());
+            bool rotated = true;
+            if (ok)
+            {
+                logSize += batch.size();
+                if (begin)
+                {
+                    // records up to seq are the ones the checkpoint starts from
+                    rotated = _RotateLog();
+                    logSize = 0;
+                }
+            }
+            if (copied)
+            {
+                imageWriter = std::thread(&DurableTree::_WriteImage, this);
+            }
+
+            lock.lock();
+            if (ok)
+            {
+                durableSeq = seq;
+                while (!undo.empty() && undo.front().seq <= seq)
+                {
+                    undo.pop_front();
+                }
+            }
+            if ((!ok || !rotated || imageFailed) && !failed)
+            {
+                _Fail();
+            }
+            flushed.notify_all();
+        }
+    }
+
+public:
+    /// @param path files are <path>.log and <path>.ckpt
+    /// @exception runtime_error : files can't be opened or the checkpoint is corrupted
+    explicit DurableTree(const std::string &path, DurableOptions options = DurableOptions())
+        : path(path), options(options)
+    {
+        _Recover();
+        flusher = std::thread(&DurableTree::_Flush, this);
+    }
+
+    ~DurableTree()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        flushWanted.notify_one();
+        flusher.join();
+    }
+
+    DurableTree(const DurableTree &) = delete;
+    DurableTree &operator=(const DurableTree &) = delete;
+
+    /// @brief insert key and value,returns once it is on disk
+    /// @exception runtime_error : the log can't be written
+    void Insert(const K &key, const V &value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        _CheckLog();
+        _Remember(key);
+        tree.Insert(key, value);
+        _WaitDurable(lock, _Append(OpInsert, key, &value));
+    }
+
+    /// @brief update value on key,returns once it is on disk
+    /// @exception runtime_error : can't find Key,or the log can't be written
+    void Update(const K &key, const V &value)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        _CheckLog();
+        if (!tree.Contain(key))
+        {
+            throw std::runtime_error("Key " + _KeyText(key) + " Not Found For Update");
+        }
+        _Remember(key);
+        tree.Update(key, value);
+        _WaitDurable(lock, _Append(OpInsert, key, &value));
+    }
+
+    /// @brief delete,when key can't find,pass
+    /// @exception runtime_error : the log can't be written
+    void Delete(const K &key)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        _CheckLog();
+        if (!tree.Contain(key))
+        {
+            return;
+        }
+        _Remember(key);
+        tree.Delete(key);
+        _WaitDurable(lock, _Append(OpDelete, key, nullptr));
+    }
+
+    /// @brief read-modify-write one key as a single logged operation.
+    /// change(const V *old,V &value) gets the current value (nullptr when missing),
+    /// sets value and returns true to store it,false to delete the key
+    template <typename Change>
+    void Apply(const K &key, Change change)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        _CheckLog();
+        bool exists = tree.Contain(key);
+        V old = exists ? tree.Get(key) : V();
+        V value = old;
+        if (change(exists ? &old : nullptr, value))
+        {
+            _Remember(key);
+            tree.Insert(key, value);
+            _WaitDurable(lock, _Append(OpInsert, key, &value));
+        }
+        else if (exists)
+        {
+            _Remember(key);
+            tree.Delete(key);
+            _WaitDurable(lock, _Append(OpDelete, key, nullptr));
+        }
+    }
+
+    /// @brief get a copy of the value on key
+    /// @exception runtime_error : can't find key
+    V Get(const K &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tree.Get(key);
+    }
+
+    /// @brief whether key exists?
+    bool Contain(const K &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tree.Contain(key);
+    }
+
+    /// @brief number of keys
+    std::size_t Size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tree.Size();
+    }
+
+    /// @brief write a checkpoint now and drop the log records it covers
+    /// @exception runtime_error : the checkpoint can't be written
+    void Checkpoint()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // a checkpoint already running may have missed the latest writes
+        std::uint64_t target = checkpointsTaken + 1;
+        checkpointWanted = true;
+        flushWanted.notify_one();
+        flushed.wait(lock, [&] { return checkpointsWritten >= target || failed || imageFailed; });
+        if (failed || imageFailed)
+        {
+            throw std::runtime_error("Checkpoint of " + path + " failed");
+        }
+    }
+
+    void Print()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.Print(true);
+    }
+};
+
+/// @brief SetTree on top of DurableTree,counts are logged like values
+/// @tparam K : needs a LogCodec
+template <typename K>
+class DurableSetTree
+{
+private:
+    DurableTree<K, int> tree;
+
+public:
+    explicit DurableSetTree(const std::string &path, DurableOptions options = DurableOptions())
+        : tree(path, options)
+    {
+    }
+
+    /// @brief insert the key
+    void Insert(const K &key)
+    {
+        tree.Apply(key, [](const int *old, int &count)
+                   {
+                       count = old ? *old + 1 : 1;
+                       return true;
+                   });
+    }
+
+    /// @brief delete the key,if can't find,pass
+    void Delete(const K &key)
+    {
+        tree.Apply(key, [](const int *old, int &count)
+                   {
+                       count = old ? *old - 1 : 0;
+                       return count > 0;
+                   });
+    }
+
+    /// @brief delete the whole key
+    void RemoveAll(const K &key)
+    {
+        tree.Delete(key);
+    }
+
+    /// @brief whether key exists?
+    bool Contain(const K &key)
+    {
+        return tree.Contain(key);
+    }
+
+    /// @brief get the key Count. 0 if not exist
+    int GetCount(const K &key)
+    {
+        try
+        {
+            return tree.Get(key);
+        }
+        catch (const std::runtime_error &e)
+        {
+            return 0;
+        }
+    }
+
+    /// @brief write a checkpoint now,see DurableTree::Checkpoint
+    void Checkpoint()
+    {
+        tree.Checkpoint();
+    }
+
+    void Print()
+    {
+        tree.Print();
+    }
+};
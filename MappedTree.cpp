@@ -0,0 +1,600 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// @brief red-black tree living in a memory-mapped file (POSIX).
+/// nodes are linked by offsets from the start of the file,so the file can be
+/// reopened after a restart without rebuilding,or opened read-only by other processes
+/// (they see a consistent tree while nobody writes it,and follow the file as it grows).
+/// freed nodes go to a free list inside the file and are reused by Insert
+/// @tparam K : trivially copyable,must have operator> , operator< , operator==
+/// @tparam V : trivially copyable
+template <typename K, typename V>
+class MappedRBTree
+{
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                  "MappedRBTree: K and V must be trivially copyable");
+
+private:
+    // offset from the start of the mapping,0 is nullptr
+    typedef std::uint64_t Offset;
+
+    enum Color : std::uint8_t
+    {
+        Red,
+        Black
+    };
+
+    struct Node
+    {
+        K key;
+        V data;
+        Offset left;
+        Offset right;
+        Offset parent;
+        Color color;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t keySize;
+        std::uint32_t valueSize;
+        std::uint64_t nodeSize;
+        Offset root;
+        // freed nodes,linked through left
+        Offset freeList;
+        // first byte never handed out
+        Offset end;
+        std::uint64_t count;
+    };
+
+    static constexpr const char *Magic = "RBTMAP01";
+    static constexpr std::size_t InitialBytes = 64 * 1024;
+    // a red-black tree is never deeper than this,a longer walk means the file changed under a reader
+    static constexpr std::size_t MaxDepth = 2 * 64;
+
+    int fd;
+    // a reader remaps when another process has grown the file,even in const members
+    mutable char *base;
+    mutable std::size_t mapped;
+    bool readOnly;
+
+    Header *_H() const
+    {
+        return reinterpret_cast<Header *>(base);
+    }
+
+    Node *_N(Offset offset) const
+    {
+        return reinterpret_cast<Node *>(base + offset);
+    }
+
+    bool _IsRed(Offset offset) const
+    {
+        return offset != 0 && _N(offset)->color == Red;
+    }
+
+    static Offset _FirstNode()
+    {
+        return (sizeof(Header) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+
+    // (re)map the first bytes of the file,growing it when writable
+    void _Map(std::size_t bytes) const
+    {
+        if (!readOnly && ::ftruncate(fd, static_cast<off_t>(bytes)) != 0)
+        {
+            throw std::runtime_error("Can't grow mapped tree file");
+        }
+        if (base != nullptr)
+        {
+            ::munmap(base, mapped);
+        }
+        int prot = readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+        void *address = ::mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            base = nullptr;
+            throw std::runtime_error("Can't map tree file");
+        }
+        base = static_cast<char *>(address);
+        mapped = bytes;
+    }
+
+    // readers: a writer may have grown the file since it was mapped
+    void _Refresh() const
+    {
+        if (!readOnly || _H()->end <= mapped)
+        {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < _H()->end)
+        {
+            throw std::runtime_error("Mapped tree changed while reading");
+        }
+        _Map(static_cast<std::size_t>(info.st_size));
+    }
+
+    // key as text for error messages,keys that aren't numbers as hex bytes
+    static std::string _KeyText(const K &key)
+    {
+        if constexpr (std::is_arithmetic<K>::value)
+        {
+            return std::to_string(key);
+        }
+        else
+        {
+            static const char hex[] = "0123456789abcdef";
+            const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&key);
+            std::string text("0x");
+            for (std::size_t i = 0; i < sizeof(K); i++)
+            {
+                text += hex[bytes[i] >> 4];
+                text += hex[bytes[i] & 15];
+            }
+            return text;
+        }
+    }
+
+    void _Writable() const
+    {
+        if (readOnly)
+        {
+            throw std::runtime_error("Mapped tree is read-only");
+        }
+    }
+
+    // make sure _Allocate won't remap,node pointers stay valid after this
+    void _Reserve()
+    {
+        if (_H()->freeList != 0 || _H()->end + sizeof(Node) <= mapped)
+        {
+            return;
+        }
+        _Map(mapped * 2);
+    }
+
+    Offset _Allocate()
+    {
+        Header *header = _H();
+        Offset offset = header->freeList;
+        if (offset != 0)
+        {
+            header->freeList = _N(offset)->left;
+        }
+        else
+        {
+            offset = header->end;
+            header->end += sizeof(Node);
+        }
+        return offset;
+    }
+
+    void _Free(Offset offset)
+    {
+        _N(offset)->left = _H()->freeList;
+        _H()->freeList = offset;
+        _H()->count--;
+    }
+
+    Offset _Search(const K &key) const
+    {
+        _Refresh();
+        Offset current = _H()->root;
+        for (std::size_t depth = 0; current != 0; depth++)
+        {
+            // a reader never follows a link out of its mapping (or round in circles)
+            if (readOnly && (current >= mapped || mapped - current < sizeof(Node) || depth > MaxDepth))
+            {
+                throw std::runtime_error("Mapped tree changed while reading");
+            }
+            Node *node = _N(current);
+            if (key > node->key)
+            {
+                current = node->right;
+            }
+            else if (key < node->key)
+            {
+                current = node->left;
+            }
+            else
+            {
+                return current;
+            }
+        }
+        return 0;
+    }
+
+    // point parent's link to old at now
+    void _Replace(Offset parent, Offset old, Offset now)
+    {
+        if (parent == 0)
+        {
+            _H()->root = now;
+        }
+        else if (_N(parent)->left == old)
+        {
+            _N(parent)->left = now;
+        }
+        else
+        {
+            _N(parent)->right = now;
+        }
+        if (now != 0)
+        {
+            _N(now)->parent = parent;
+        }
+    }
+
+    void Rotate_L(Offset node)
+    {
+        Node *n = _N(node);
+        Offset r = n->right;
+        Offset rl = _N(r)->left;
+
+        n->right = rl;
+        if (rl)
+        {
+            _N(rl)->parent = node;
+        }
+        _Replace(n->parent, node, r);
+        _N(r)->left = node;
+        n->parent = r;
+    }
+
+    void Rotate_R(Offset node)
+    {
+        Node *n = _N(node);
+        Offset l = n->left;
+        Offset lr = _N(l)->right;
+
+        n->left = lr;
+        if (lr)
+        {
+            _N(lr)->parent = node;
+        }
+        _Replace(n->parent, node, l);
+        _N(l)->right = node;
+        n->parent = l;
+    }
+
+    // current is red and may have a red parent
+    void _InsertFixUp(Offset current)
+    {
+        Offset parent = _N(current)->parent;
+        while (parent && _N(parent)->color == Red)
+        {
+            Offset grandparent = _N(parent)->parent;
+            bool left = (parent == _N(grandparent)->left);
+            Offset uncle = left ? _N(grandparent)->right : _N(grandparent)->left;
+
+            // Situation 1: red uncle,push the red up
+            if (_IsRed(uncle))
+            {
+                _N(parent)->color = _N(uncle)->color = Black;
+                _N(grandparent)->color = Red;
+                current = grandparent;
+                parent = _N(current)->parent;
+                continue;
+            }
+            // Situation 2: LL / RR
+            if (left == (current == _N(parent)->left))
+            {
+                left ? Rotate_R(grandparent) : Rotate_L(grandparent);
+                _N(parent)->color = Black;
+            }
+            // Situation 3: LR / RL
+            else
+            {
+                left ? Rotate_L(parent) : Rotate_R(parent);
+                left ? Rotate_R(grandparent) : Rotate_L(grandparent);
+                _N(current)->color = Black;
+            }
+            _N(grandparent)->color = Red;
+            break;
+        }
+        _N(_H()->root)->color = Black;
+    }
+
+    // parent ->isLeftNode has 2-black
+    void _DeleteFixUp(Offset parent, bool isLeft)
+    {
+        while (true)
+        {
+            Offset brother = isLeft ? _N(parent)->right : _N(parent)->left;
+            // brother is red: rotate it up,the new brother is black
+            if (_N(brother)->color == Red)
+            {
+                _N(brother)->color = Black;
+                _N(parent)->color = Red;
+                isLeft ? Rotate_L(parent) : Rotate_R(parent);
+                continue;
+            }
+            Offset nearChild = isLeft ? _N(brother)->left : _N(brother)->right;
+            Offset farChild = isLeft ? _N(brother)->right : _N(brother)->left;
+            // brother has a red child far from us: LL / RR
+            if (_IsRed(farChild))
+            {
+                _N(farChild)->color = Black;
+                _N(brother)->color = _N(parent)->color;
+                _N(parent)->color = Black;
+                isLeft ? Rotate_L(parent) : Rotate_R(parent);
+                return;
+            }
+            // only the near child is red: LR / RL
+            if (_IsRed(nearChild))
+            {
+                _N(nearChild)->color = _N(parent)->color;
+                _N(parent)->color = Black;
+                isLeft ? Rotate_R(brother) : Rotate_L(brother);
+                isLeft ? Rotate_L(parent) : Rotate_R(parent);
+                return;
+            }
+            // brother with 0 red child: 2-black up
+            _N(brother)->color = Red;
+            if (_N(parent)->color == Red || parent == _H()->root)
+            {
+                _N(parent)->color = Black;
+                return;
+            }
+            Offset grandparent = _N(parent)->parent;
+            isLeft = (parent == _N(grandparent)->left);
+            parent = grandparent;
+        }
+    }
+
+    // map the open file,set up the header of a new one
+    void _Open(const std::string &path)
+    {
+        struct stat info;
+        if (::fstat(fd, &info) != 0)
+        {
+            throw std::runtime_error("Can't open mapped tree " + path);
+        }
+        if (info.st_size == 0 && !readOnly)
+        {
+            _Map(InitialBytes);
+            Header *header = _H();
+            std::memcpy(header->magic, Magic, sizeof(header->magic));
+            header->keySize = sizeof(K);
+            header->valueSize = sizeof(V);
+            header->nodeSize = sizeof(Node);
+            header->root = header->freeList = 0;
+            header->end = _FirstNode();
+            header->count = 0;
+            return;
+        }
+        if (static_cast<std::size_t>(info.st_size) < sizeof(Header))
+        {
+            throw std::runtime_error("Mapped tree " + path + " is corrupted");
+        }
+        _Map(static_cast<std::size_t>(info.st_size));
+        Header *header = _H();
+        if (std::memcmp(header->magic, Magic, sizeof(header->magic)) != 0 ||
+            header->keySize != sizeof(K) || header->valueSize != sizeof(V) ||
+            header->nodeSize != sizeof(Node) || header->end > mapped)
+        {
+            throw std::runtime_error("Mapped tree " + path + " holds another tree type");
+        }
+    }
+
+public:
+    /// @brief open path,creating an empty tree when it doesn't exist
+    /// @param readOnly map read-only,writes throw
+    /// @exception runtime_error : can't open or map the file,or it holds another tree type
+    explicit MappedRBTree(const std::string &path, bool readOnly = false)
+        : fd(-1), base(nullptr), mapped(0), readOnly(readOnly)
+    {
+        fd = ::open(path.c_str(), readOnly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Can't open mapped tree " + path);
+        }
+        try
+        {
+            _Open(path);
+        }
+        catch (...)
+        {
+            // the destructor doesn't run for a constructor that throws
+            if (base != nullptr)
+            {
+                ::munmap(base, mapped);
+            }
+            ::close(fd);
+            throw;
+        }
+    }
+
+    ~MappedRBTree()
+    {
+        if (base != nullptr)
+        {
+            ::munmap(base, mapped);
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+    }
+
+    MappedRBTree(const MappedRBTree &) = delete;
+    MappedRBTree &operator=(const MappedRBTree &) = delete;
+
+    /// @brief is empty
+    bool Empty() const
+    {
+        return _H()->root == 0;
+    }
+
+    /// @brief number of keys
+    std::size_t Size() const
+    {
+        return _H()->count;
+    }
+
+    /// @brief insert key and value.when key exists,update value
+    /// @exception runtime_error : read-only,or the file can't grow
+    void Insert(const K &key, const V &value)
+    {
+        _Writable();
+        _Reserve();
+
+        Offset parent = 0;
+        Offset current = _H()->root;
+        bool left = false;
+        while (current != 0)
+        {
+            Node *node = _N(current);
+            parent = current;
+            if (key > node->key)
+            {
+                current = node->right;
+                left = false;
+            }
+            else if (key < node->key)
+            {
+                current = node->left;
+                left = true;
+            }
+            else // equal
+            {
+                node->data = value;
+                return;
+            }
+        }
+
+        current = _Allocate();
+        Node *node = _N(current);
+        node->key = key;
+        node->data = value;
+        node->left = node->right = 0;
+        node->parent = parent;
+        node->color = Red;
+        if (parent == 0)
+        {
+            _H()->root = current;
+        }
+        else if (left)
+        {
+            _N(parent)->left = current;
+        }
+        else
+        {
+            _N(parent)->right = current;
+        }
+        _H()->count++;
+        _InsertFixUp(current);
+    }
+
+    /// @brief delete,when key can't find,pass
+    /// @exception runtime_error : read-only
+    void Delete(const K &key)
+    {
+        _Writable();
+        Offset current = _Search(key);
+        if (current == 0)
+        {
+            return;
+        }
+
+        // 2 children -> move the successor here and delete it instead
+        Node *node = _N(current);
+        if (node->left && node->right)
+        {
+            Offset minRight = node->right;
+            while (_N(minRight)->left)
+            {
+                minRight = _N(minRight)->left;
+            }
+            node->key = _N(minRight)->key;
+            node->data = _N(minRight)->data;
+            current = minRight;
+            node = _N(current);
+        }
+
+        Offset parent = node->parent;
+        Offset child = node->left ? node->left : node->right;
+        // red with 0 child,or black with 1 child (must be red)
+        if (node->color == Red || child != 0)
+        {
+            _Replace(parent, current, child);
+            if (child)
+            {
+                _N(child)->color = Black;
+            }
+            _Free(current);
+            return;
+        }
+        // black with 0 child
+        bool isLeft = (parent != 0 && _N(parent)->left == current);
+        _Replace(parent, current, 0);
+        _Free(current);
+        if (parent != 0)
+        {
+            _DeleteFixUp(parent, isLeft);
+        }
+    }
+
+    /// @brief get value on key
+    /// @exception runtime_error : can't find key,or (read-only) the file changed while reading
+    V Get(const K &key) const
+    {
+        Offset node = _Search(key);
+        if (node == 0)
+        {
+            throw std::runtime_error("Key " + _KeyText(key) + " Not Found");
+        }
+        return _N(node)->data;
+    }
+
+    /// @brief whether key exists?
+    /// @exception runtime_error : (read-only) the file changed while reading
+    bool Contain(const K &key) const
+    {
+        return _Search(key) != 0;
+    }
+
+    /// @brief update value on key
+    /// @exception runtime_error : can't find Key,or read-only
+    void Update(const K &key, const V &value)
+    {
+        _Writable();
+        Offset node = _Search(key);
+        if (node == 0)
+        {
+            throw std::runtime_error(
+                "Key " + _KeyText(key) + " Not Found For Update");
+        }
+        _N(node)->data = value;
+    }
+
+    /// @brief delete the whole tree,the file keeps its size
+    void Clear()
+    {
+        _Writable();
+        Header *header = _H();
+        header->root = header->freeList = 0;
+        header->end = _FirstNode();
+        header->count = 0;
+    }
+
+    /// @brief write dirty pages to the file now
+    /// @exception runtime_error : msync failed
+    void Sync()
+    {
+        if (::msync(base, mapped, MS_SYNC) != 0)
+        {
+            throw std::runtime_error("Can't sync mapped tree");
+        }
+    }
+};
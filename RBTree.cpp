@@ -1,11 +1,171 @@
+#pragma once
 #include <iostream>
 #include <cstdint>
 #include <random>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <new>
+#include <functional>
+#include <utility>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <sstream>
+#include <cstring>
+#include "TraceRecorder.cpp"
+
+/// @brief how Clone places the copied nodes in memory
+enum class NodeLayout : std::uint8_t
+{
+    // one heap allocation per node
+    Heap,
+    // one contiguous block, nodes in key order
+    InOrder,
+    // one contiguous block, nodes in van Emde Boas order
+    VEB,
+    // one contiguous block, nodes level by level
+    BreadthFirst
+};
+
+/// @brief what RBTree::Dump writes
+enum class DumpFormat : std::uint8_t
+{
+    // the Print view
+    Tree,
+    // Graphviz digraph
+    DOT,
+    // nested {"key","color","left","right"} objects
+    JSON
+};
+
+/// @brief string key that doesn't own its bytes,StringTree keeps them in its arena.
+/// a view of a caller's string works for lookups
+struct StringKey
+{
+    const char *data;
+    std::uint32_t size;
+
+    /// @brief three-way compare starting at byte skip (the caller knows the
+    /// first skip bytes match),lcp gets the common prefix length
+    static int Compare(const StringKey &a, const StringKey &b, std::uint32_t skip, std::uint32_t &lcp)
+    {
+        std::uint32_t n = std::min(a.size, b.size);
+        std::uint32_t i = skip;
+#if (defined(__GNUC__) || defined(__clang__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // eight bytes at a time,the lowest differing bit is in the first differing byte
+        while (i + 8 <= n)
+        {
+            std::uint64_t x, y;
+            std::memcpy(&x, a.data + i, 8);
+            std::memcpy(&y, b.data + i, 8);
+            if (x != y)
+            {
+                i += __builtin_ctzll(x ^ y) >> 3;
+                break;
+            }
+            i += 8;
+        }
+#endif
+        while (i < n && a.data[i] == b.data[i])
+        {
+            i++;
+        }
+        lcp = i;
+        if (i < n)
+        {
+            return static_cast<unsigned char>(a.data[i]) < static_cast<unsigned char>(b.data[i]) ? -1 : 1;
+        }
+        return a.size < b.size ? -1 : (a.size > b.size ? 1 : 0);
+    }
+
+    static int Compare(const StringKey &a, const StringKey &b)
+    {
+        std::uint32_t lcp;
+        return Compare(a, b, 0, lcp);
+    }
+
+    bool operator<(const StringKey &other) const
+    {
+        return Compare(*this, other) < 0;
+    }
+    bool operator>(const StringKey &other) const
+    {
+        return Compare(*this, other) > 0;
+    }
+    bool operator==(const StringKey &other) const
+    {
+        return size == other.size && std::memcmp(data, other.data, size) == 0;
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const StringKey &key)
+{
+    return out.write(key.data, key.size);
+}
+
+namespace std
+{
+    template <>
+    struct hash<StringKey>
+    {
+        std::size_t operator()(const StringKey &key) const
+        {
+            // FNV-1a
+            std::uint64_t h = 14695981039346656037ull;
+            for (std::uint32_t i = 0; i < key.size; i++)
+            {
+                h = (h ^ static_cast<unsigned char>(key.data[i])) * 1099511628211ull;
+            }
+            return static_cast<std::size_t>(h);
+        }
+    };
+}
+
+// whether std::hash<K> works,only the front cache (EnableCache) needs it
+template <typename K, typename = void>
+struct _IsHashable : std::false_type
+{
+};
+
+template <typename K>
+struct _IsHashable<K, std::void_t<decltype(std::hash<K>()(std::declval<const K &>()))>> : std::true_type
+{
+};
+
+template <typename K, typename = void>
+struct _IsPrintable : std::false_type
+{
+};
+
+template <typename K>
+struct _IsPrintable<K, std::void_t<decltype(std::declval<std::ostream &>() << std::declval<const K &>())>> : std::true_type
+{
+};
+
+// key as text for error messages,keys that aren't numbers go through operator<<
+// when they have one
+template <typename K>
+std::string _KeyText(const K &key)
+{
+    if constexpr (std::is_arithmetic<K>::value)
+    {
+        return std::to_string(key);
+    }
+    else if constexpr (_IsPrintable<K>::value)
+    {
+        std::ostringstream out;
+        out << key;
+        return out.str();
+    }
+    else
+    {
+        return "?";
+    }
+}
 
 /// @brief RBTree
-/// @tparam K : must have operator> , operator< , operator==
+/// @tparam K : must have operator> , operator< , operator== (EnableCache also needs std::hash)
 /// @tparam V : Any
 template <typename K, typename V>
 class RBTree
@@ -26,17 +186,21 @@ private:
         TreeNode *right;
         TreeNode *parent;
         Color color;
+        // lives inside one of the tree's blocks, not allocated by new
+        bool pooled;
+        // lazily deleted,skipped by lookups until Compact removes it
+        bool dead;
 
         TreeNode(K key, V value, Color col)
-            : key(key), data(value), left(nullptr), right(nullptr), parent(nullptr), color(col)
+            : key(std::move(key)), data(std::move(value)), left(nullptr), right(nullptr), parent(nullptr), color(col), pooled(false), dead(false)
         {
         }
         TreeNode(K key, V value)
-            : key(key), data(value), left(nullptr), right(nullptr), parent(nullptr), color(NColor)
+            : key(std::move(key)), data(std::move(value)), left(nullptr), right(nullptr), parent(nullptr), color(NColor), pooled(false), dead(false)
         {
         }
         TreeNode()
-            : key(K()), data(V()), left(nullptr), right(nullptr), parent(nullptr), color(NColor)
+            : key(K()), data(V()), left(nullptr), right(nullptr), parent(nullptr), color(NColor), pooled(false), dead(false)
         {
         }
         TreeNode(const TreeNode &) = delete;
@@ -46,51 +210,118 @@ private:
         }
     };
 
+    // nodes shared by trees created with Share, freed with the last owner
+    struct SharedNodes
+    {
+        TreeNode *root;
+        std::vector<void *> blocks;
+
+        SharedNodes(TreeNode *root, std::vector<void *> &&blocks)
+            : root(root), blocks(std::move(blocks))
+        {
+        }
+        SharedNodes(const SharedNodes &) = delete;
+        SharedNodes &operator=(const SharedNodes &) = delete;
+        ~SharedNodes()
+        {
+            _Destroy(root);
+            _ReleaseBlocks(blocks);
+        }
+    };
+
+    // state of the opt-in features,kept out of line so a plain tree
+    // (say one of millions of tiny SetTrees) doesn't pay for it
+    struct Extras
+    {
+        // front cache for Get/Contain,slot = hash(key) & (size - 1).
+        // a node keeps its key through Insert/Update/rotations,so only freeing
+        // or copying nodes has to touch it
+        std::vector<TreeNode *> cache;
+        std::size_t cacheHits = 0;
+        std::size_t cacheMisses = 0;
+        // Delete only marks nodes,see SetLazyDelete
+        bool lazyDelete = false;
+        double compactThreshold = 0.25;
+        // not nullptr while calls are being recorded,see SetRecorder
+        TraceRecorder<K> *recorder = nullptr;
+        // relayout in progress (CompactStep): nodes still to move in breadth-first
+        // order from stepHead on,moved into stepSlots
+        std::vector<TreeNode *> stepQueue;
+        std::size_t stepHead = 0;
+        TreeNode *stepSlots = nullptr;
+        std::size_t stepUsed = 0;
+    };
+
     // the main root of the tree
     TreeNode *root;
+    // contiguous node storage owned by this tree (see NodeLayout)
+    std::vector<void *> blocks;
+    // not null while root belongs to nodes shared with other trees
+    std::shared_ptr<SharedNodes> shared;
+    // nodes in the tree,tombstones included
+    std::size_t count = 0;
+    std::size_t tombstones = 0;
+    // first and last node in key order,tombstones included
+    TreeNode *leftmost = nullptr;
+    TreeNode *rightmost = nullptr;
+    // nullptr until an opt-in feature (cache,lazy delete,recorder,CompactStep) is used
+    std::unique_ptr<Extras> extras;
 
     void _Insert(TreeNode *&node, const K &key, const V &value)
     {
         if (node == nullptr)
         {
             node = new TreeNode(key, value, Black);
+            count++;
+            leftmost = rightmost = node;
             return;
         }
         TreeNode *parent = nullptr;
-        TreeNode *current = node;
+        TreeNode *current = _Descend(key, parent);
 
-        // let current=nullptr,parent=current->parent
-        while (current) // current!=nullptr
+        // equal
+        if (current)
         {
-            if (key > current->key)
-            {
-                parent = current;
-                current = current->right;
-            }
-            else if (key < current->key)
-            {
-                parent = current;
-                current = current->left;
-            }
-            else // equal
+            current->data = value;
+            if (current->dead)
             {
-                current->data = value;
-                return;
+                current->dead = false;
+                tombstones--;
             }
+            return;
         }
 
         current = new TreeNode(key, value, Red);
+        count++;
         if (key > parent->key)
         {
             parent->right = current;
             current->parent = parent;
+            if (parent == rightmost)
+            {
+                rightmost = current;
+            }
         }
         else
         {
             parent->left = current;
             current->parent = parent;
+            if (parent == leftmost)
+            {
+                leftmost = current;
+            }
         }
 
+        _InsertFixUp(current);
+        node->color = Black;
+    }
+
+    // current is a new red node,its parent may be red too.
+    // leaves the root as it is,the caller makes it black
+    void _InsertFixUp(TreeNode *current)
+    {
+        TreeNode *parent = current->parent;
+
         // (current->color==Red && parent->color==Red) against rule
         // when parent is nullptr,current is root
         while (parent && parent->color == Red)
@@ -173,7 +404,6 @@ private:
                 }
             }
         }
-        node->color = Black;
     }
 
     // node: from where to delete
@@ -184,36 +414,47 @@ private:
             throw std::runtime_error("root is empty");
         }
 
-        // from node
-        TreeNode *current = node;
-        while (current)
+        // node is root,so the shared descent (and its fast paths) finds it
+        TreeNode *current = _Search(key);
+        if (current == nullptr)
+        {
+            throw std::runtime_error(
+                "Key " + _KeyText(key) + " Not Found For Deletion");
+        }
+
+        // now current is to delete
+        _DeleteNode(current);
+    }
+
+    // current: the node to delete
+    void _DeleteNode(TreeNode *current)
+    {
+        count--;
+        if (current->dead)
+        {
+            tombstones--;
+        }
+        if (current->left && current->right)
         {
-            if (key > current->key)
+            // the successor is moved into current and freed
+            TreeNode *minRight = _Next(current);
+            if (minRight == rightmost)
             {
-                current = current->right;
-                if (current == nullptr)
-                {
-                    throw std::runtime_error(
-                        "Key " + std::to_string(key) + " Not Found For Deletion");
-                }
+                rightmost = current;
             }
-            else if (key < current->key)
+        }
+        else
+        {
+            if (current == leftmost)
             {
-                current = current->left;
-                if (current == nullptr)
-                {
-                    throw std::runtime_error(
-                        "Key " + std::to_string(key) + " Not Found For Deletion");
-                }
+                leftmost = _Next(current);
             }
-            else // equal
+            if (current == rightmost)
             {
-                break;
+                rightmost = _Prev(current);
             }
         }
 
-        // now current is to delete
-
         // Situation 1: red nil-> delete
         if (current->color == Red &&
             current->left == nullptr && current->right == nullptr)
@@ -232,8 +473,11 @@ private:
             {
                 minRight = minRight->left;
             }
+            _Forget(current);
+            _Forget(minRight);
             current->key = std::move(minRight->key);
             current->data = std::move(minRight->data);
+            current->dead = minRight->dead;
             _Delete01Child(minRight);
             return;
         }
@@ -264,8 +508,11 @@ private:
             {
                 minRight = minRight->left;
             }
+            _Forget(current);
+            _Forget(minRight);
             current->key = std::move(minRight->key);
             current->data = std::move(minRight->data);
+            current->dead = minRight->dead;
             _Delete01Child(minRight);
             return;
         }
@@ -303,7 +550,8 @@ private:
         {
             parent->right = nullptr;
         }
-        delete current;
+        _Forget(current);
+        _FreeNode(current);
         current = nullptr;
     }
 
@@ -356,7 +604,8 @@ private:
                 parent->right = child;
             }
         }
-        delete current;
+        _Forget(current);
+        _FreeNode(current);
         current = nullptr;
     }
 
@@ -365,7 +614,8 @@ private:
     {
         if (current == root)
         {
-            delete current;
+            _Forget(current);
+            _FreeNode(current);
             root = nullptr;
             return;
         }
@@ -380,7 +630,8 @@ private:
         {
             parent->right = nullptr;
         }
-        delete current;
+        _Forget(current);
+        _FreeNode(current);
         current = nullptr;
 
         // now parent ->isLeftNode has 2-black
@@ -482,303 +733,2316 @@ private:
         }
     }
 
-    void _Print(TreeNode *root, bool isLeft, std::string prefix) const
-    {
-        if (root == nullptr)
-        {
-            return;
-        }
+    // red-black height is at most 2 * log2(n + 1),so a dump never needs more
+    // stack frames than this
+    static constexpr std::size_t DumpStack = 2 * 64 + 2;
 
-        std::cout << prefix;
-        std::cout << (isLeft ? "├──" : "└──");
-        std::cout << root->key;
-        switch (root->color)
+    static const char *_ColorName(Color color)
+    {
+        switch (color)
         {
         case Black:
-            std::cout << "(Black)" << std::endl;
-            break;
+            return "Black";
         case Red:
-            std::cout << "(Red)" << std::endl;
-            break;
+            return "Red";
         default:
-            std::cout << "(None)" << std::endl;
+            return "None";
         }
-
-        _Print(root->left, true, prefix + (isLeft ? "│   " : "    "));
-        _Print(root->right, false, prefix + (isLeft ? "│   " : "    "));
     }
 
-    void _PrintWithData(TreeNode *root, bool isLeft, std::string prefix) const
+    // text as a quoted string,escaped for JSON (DOT reads the same escapes)
+    static void _Quote(std::ostream &out, const char *text, std::size_t size)
     {
-        if (root == nullptr)
-        {
-            return;
-        }
-
-        std::cout << prefix;
-        std::cout << (isLeft ? "├──" : "└──");
-        std::cout << root->key;
-        switch (root->color)
+        static const char hex[] = "0123456789abcdef";
+        out.put('"');
+        for (std::size_t i = 0; i < size; i++)
         {
-        case Black:
-            std::cout << "(Black)";
-            break;
-        case Red:
-            std::cout << "(Red)";
-            break;
-        default:
-            std::cout << "(None)";
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c == '"' || c == '\\')
+            {
+                out.put('\\');
+                out.put(static_cast<char>(c));
+            }
+            else if (c < 0x20)
+            {
+                out << "\\u00" << hex[c >> 4] << hex[c & 15];
+            }
+            else
+            {
+                out.put(static_cast<char>(c));
+            }
         }
-        std::cout << " [" << root->data << "]" << std::endl;
-
-        _PrintWithData(root->left, true, prefix + (isLeft ? "│   " : "    "));
-        _PrintWithData(root->right, false, prefix + (isLeft ? "│   " : "    "));
+        out.put('"');
     }
 
-    void _Destroy(TreeNode *&node)
+    // numbers as they are,everything else as a quoted string
+    template <typename T>
+    static void _DumpValue(std::ostream &out, const T &value)
     {
-        if (node == nullptr)
+        if constexpr (std::is_same<T, bool>::value)
         {
-            return;
+            out << (value ? "true" : "false");
+        }
+        else if constexpr (std::is_arithmetic<T>::value)
+        {
+            out << +value;
+        }
+        else if constexpr (std::is_same<T, std::string>::value)
+        {
+            _Quote(out, value.data(), value.size());
+        }
+        else if constexpr (std::is_same<T, StringKey>::value)
+        {
+            _Quote(out, value.data, value.size);
+        }
+        else
+        {
+            std::ostringstream text;
+            text << value;
+            const std::string &bytes = text.str();
+            _Quote(out, bytes.data(), bytes.size());
         }
-        _Destroy(node->left);
-        _Destroy(node->right);
-        delete node;
-        node = nullptr;
     }
 
-    void _Clear()
+    // the Print view,pre-order. a node's prefix extends its parent's,so one
+    // buffer holds every prefix: a node cuts it back to its own length
+    std::size_t _DumpTree(std::ostream &out, bool displayData, std::size_t maxDepth, std::size_t maxNodes) const
     {
-        _Destroy(root);
+        struct Frame
+        {
+            TreeNode *node;
+            std::uint32_t depth;
+            std::uint32_t prefix;
+            bool isLeft;
+        };
+        Frame stack[DumpStack];
+        char prefix[DumpStack * 6];
+        std::size_t top = 0;
+        std::size_t written = 0;
+        stack[top++] = {root, 0, 0, false};
+        while (top > 0 && written < maxNodes)
+        {
+            Frame frame = stack[--top];
+            TreeNode *node = frame.node;
+            out.write(prefix, frame.prefix);
+            out << (frame.isLeft ? "├──" : "└──") << node->key << '(' << _ColorName(node->color) << ')';
+            if (node->dead)
+            {
+                out << "(Deleted)";
+            }
+            if (displayData)
+            {
+                out << " [" << node->data << ']';
+            }
+            out << '\n';
+            written++;
+
+            if (frame.depth >= maxDepth || top + 2 > DumpStack)
+            {
+                continue;
+            }
+            const char *indent = frame.isLeft ? "│   " : "    ";
+            std::size_t length = std::strlen(indent);
+            std::memcpy(prefix + frame.prefix, indent, length);
+            std::uint32_t childPrefix = frame.prefix + static_cast<std::uint32_t>(length);
+            // right first,so left comes off the stack first
+            if (node->right)
+            {
+                stack[top++] = {node->right, frame.depth + 1, childPrefix, false};
+            }
+            if (node->left)
+            {
+                stack[top++] = {node->left, frame.depth + 1, childPrefix, true};
+            }
+        }
+        return written;
     }
 
-    void Rotate_L(TreeNode *node)
+    // Graphviz digraph,nodes are numbered in the order they are written
+    std::size_t _DumpDot(std::ostream &out, bool displayData, std::size_t maxDepth, std::size_t maxNodes) const
     {
-        TreeNode *r = node->right;
-        TreeNode *rl = r->left;
-
-        node->right = rl;
-        if (rl)
+        struct Frame
         {
-            rl->parent = node;
-        }
-
-        TreeNode *parent = node->parent;
-
-        r->left = node;
-        node->parent = r;
-
-        // node is root
-        if (parent == nullptr)
+            TreeNode *node;
+            std::size_t parent;
+            std::uint32_t depth;
+        };
+        Frame stack[DumpStack];
+        std::size_t top = 0;
+        std::size_t written = 0;
+        out << "digraph RBTree {\n    node [style=filled, fontcolor=white];\n";
+        if (root)
         {
-            root = r;
-            root->parent = nullptr;
+            stack[top++] = {root, SIZE_MAX, 0};
         }
-        else
+        while (top > 0 && written < maxNodes)
         {
-            if (parent->left == node)
+            Frame frame = stack[--top];
+            TreeNode *node = frame.node;
+            std::size_t id = written++;
+            out << "    n" << id << " [label=";
+            _DumpValue(out, node->key);
+            if (displayData)
             {
-                parent->left = r;
+                out << ", xlabel=";
+                _DumpValue(out, node->data);
             }
-            else
+            out << ", fillcolor=" << (node->color == Red ? "red" : "black");
+            if (node->dead)
             {
-                parent->right = r;
+                out << ", style=\"filled,dashed\", color=gray";
+            }
+            out << "];\n";
+            if (frame.parent != SIZE_MAX)
+            {
+                out << "    n" << frame.parent << " -> n" << id << ";\n";
+            }
+
+            if (frame.depth >= maxDepth || top + 2 > DumpStack)
+            {
+                continue;
+            }
+            if (node->right)
+            {
+                stack[top++] = {node->right, id, frame.depth + 1};
+            }
+            if (node->left)
+            {
+                stack[top++] = {node->left, id, frame.depth + 1};
             }
-            r->parent = parent;
         }
+        return written;
     }
 
-    void Rotate_R(TreeNode *node)
+    // nested {"key","color","left","right"} objects. a frame stays on the stack
+    // until both children are written,stage says which part comes next
+    std::size_t _DumpJson(std::ostream &out, bool displayData, std::size_t maxDepth, std::size_t maxNodes) const
     {
-        TreeNode *l = node->left;
-        TreeNode *lr = l->right;
-
-        node->left = lr;
-        if (lr)
+        struct Frame
         {
-            lr->parent = node;
-        }
-
-        TreeNode *parent = node->parent;
-
-        l->right = node;
-        node->parent = l;
-
-        // node is root
-        if (parent == nullptr)
+            TreeNode *node;
+            std::uint32_t depth;
+            std::uint8_t stage;
+        };
+        Frame stack[DumpStack];
+        std::size_t top = 0;
+        std::size_t written = 0;
+        out << "{\"count\":" << count << ",\"root\":";
+        if (root && maxNodes > 0)
         {
-            root = l;
-            root->parent = nullptr;
+            stack[top++] = {root, 0, 0};
         }
         else
         {
-            if (parent->left == node)
+            out << "null";
+        }
+        while (top > 0)
+        {
+            Frame &frame = stack[top - 1];
+            TreeNode *node = frame.node;
+            TreeNode *child = nullptr;
+            switch (frame.stage++)
             {
-                parent->left = l;
+            case 0:
+                written++;
+                out << "{\"key\":";
+                _DumpValue(out, node->key);
+                out << ",\"color\":\"" << _ColorName(node->color) << '"';
+                if (node->dead)
+                {
+                    out << ",\"deleted\":true";
+                }
+                if (displayData)
+                {
+                    out << ",\"value\":";
+                    _DumpValue(out, node->data);
+                }
+                out << ",\"left\":";
+                child = node->left;
+                break;
+            case 1:
+                out << ",\"right\":";
+                child = node->right;
+                break;
+            default:
+                out << '}';
+                top--;
+                continue;
+            }
+            if (child && frame.depth < maxDepth && written < maxNodes && top < DumpStack)
+            {
+                stack[top] = {child, frame.depth + 1, 0};
+                top++;
             }
             else
             {
-                parent->right = l;
+                out << "null";
             }
-            l->parent = parent;
         }
+        out << ",\"omitted\":" << count - written << "}\n";
+        return written;
     }
 
-public:
-    RBTree() : root(nullptr)
+    static void _FreeNode(TreeNode *node)
     {
+        if (node->pooled)
+        {
+            node->~TreeNode();
+        }
+        else
+        {
+            delete node;
+        }
     }
 
-    ~RBTree()
+    static void _ReleaseBlocks(std::vector<void *> &blocks)
     {
-        _Clear();
+        for (void *block : blocks)
+        {
+            ::operator delete(block);
+        }
+        blocks.clear();
     }
 
-    RBTree(const RBTree &) = delete;
-    RBTree &operator=(const RBTree &) = delete;
-    RBTree(RBTree &&other) noexcept : root(other.root)
+    static void _Destroy(TreeNode *&node)
     {
-        other.root = nullptr;
-    }
-    RBTree &operator=(RBTree &&other) noexcept
-    {
-        if (this != &other)
+        if (node == nullptr)
         {
-            Clear();
-            root = other.root;
-            other.root = nullptr;
+            return;
+        }
+        _Destroy(node->left);
+        _Destroy(node->right);
+        _FreeNode(node);
+        node = nullptr;
+    }
+
+    void _Clear()
+    {
+        // the step block is released with the others
+        _ResetStep();
+        _ResetCache();
+        count = tombstones = 0;
+        leftmost = rightmost = nullptr;
+        if (shared)
+        {
+            root = nullptr;
+            shared.reset();
+            return;
+        }
+        _Destroy(root);
+        _ReleaseBlocks(blocks);
+    }
+
+    // must be called before anything changes the nodes
+    void _BeginWrite()
+    {
+        _EndStep();
+        if (!shared)
+        {
+            return;
+        }
+        // last owner,take the nodes back
+        if (shared.use_count() == 1)
+        {
+            blocks = std::move(shared->blocks);
+            shared->blocks.clear();
+            shared->root = nullptr;
+        }
+        else
+        {
+            root = _CopyNodes(root, nullptr);
+            _ResetCache();
+            _ResetBounds();
+        }
+        shared.reset();
+    }
+
+    Extras &_Extras()
+    {
+        if (extras == nullptr)
+        {
+            extras.reset(new Extras());
+        }
+        return *extras;
+    }
+
+    TraceRecorder<K> *_Recorder() const
+    {
+        return extras ? extras->recorder : nullptr;
+    }
+
+    // a CompactStep relayout is in progress
+    bool _Stepping() const
+    {
+        return extras && extras->stepSlots != nullptr;
+    }
+
+    void _ResetStep()
+    {
+        if (extras == nullptr)
+        {
+            return;
+        }
+        std::vector<TreeNode *>().swap(extras->stepQueue);
+        extras->stepHead = 0;
+        extras->stepSlots = nullptr;
+        extras->stepUsed = 0;
+    }
+
+    // give up a CompactStep relayout: the nodes moved so far go back to the heap
+    // and the step block is freed,so relayouts given up again and again don't pile up blocks
+    void _EndStep()
+    {
+        if (!_Stepping())
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < extras->stepUsed; i++)
+        {
+            _Relocate(extras->stepSlots + i, nullptr);
+        }
+        // the step block is always the last one
+        ::operator delete(blocks.back());
+        blocks.pop_back();
+        _ResetStep();
+    }
+
+    // move node into slot (nullptr: onto the heap),relink it and free node
+    TreeNode *_Relocate(TreeNode *node, TreeNode *slot)
+    {
+        _Forget(node);
+        TreeNode *moved = slot ? new (slot) TreeNode(std::move(node->key), std::move(node->data), node->color)
+                               : new TreeNode(std::move(node->key), std::move(node->data), node->color);
+        moved->pooled = slot != nullptr;
+        moved->dead = node->dead;
+        moved->left = node->left;
+        moved->right = node->right;
+        moved->parent = node->parent;
+
+        if (moved->parent == nullptr)
+        {
+            root = moved;
+        }
+        else if (moved->parent->left == node)
+        {
+            moved->parent->left = moved;
+        }
+        else
+        {
+            moved->parent->right = moved;
+        }
+        if (moved->left)
+        {
+            moved->left->parent = moved;
+        }
+        if (moved->right)
+        {
+            moved->right->parent = moved;
+        }
+        if (node == leftmost)
+        {
+            leftmost = moved;
+        }
+        if (node == rightmost)
+        {
+            rightmost = moved;
+        }
+        _FreeNode(node);
+        return moved;
+    }
+
+    // move node into the next slot of the CompactStep block,queue its children
+    void _MoveToSlot(TreeNode *node)
+    {
+        TreeNode *slot = _Relocate(node, extras->stepSlots + extras->stepUsed++);
+        if (slot->left)
+        {
+            extras->stepQueue.push_back(slot->left);
+        }
+        if (slot->right)
+        {
+            extras->stepQueue.push_back(slot->right);
+        }
+    }
+
+    // move everything out of other,this must be empty
+    void _Take(RBTree &other)
+    {
+        other._EndStep();
+        root = other.root;
+        blocks = std::move(other.blocks);
+        shared = std::move(other.shared);
+        extras = std::move(other.extras);
+        count = other.count;
+        tombstones = other.tombstones;
+        leftmost = other.leftmost;
+        rightmost = other.rightmost;
+
+        other.root = nullptr;
+        other.blocks.clear();
+        other.count = other.tombstones = 0;
+        other.leftmost = other.rightmost = nullptr;
+    }
+
+    // a tree reading the same nodes as this one (Clone/Share)
+    RBTree _Copy(TreeNode *nodes) const
+    {
+        RBTree copy;
+        copy.root = nodes;
+        copy.count = count;
+        copy.tombstones = tombstones;
+        if (extras && extras->lazyDelete)
+        {
+            copy._Extras().lazyDelete = true;
+            copy.extras->compactThreshold = extras->compactThreshold;
+        }
+        copy._ResetBounds();
+        return copy;
+    }
+
+    // drop node from the front cache before it is freed or its key moves
+    void _Forget(TreeNode *node)
+    {
+        if constexpr (_IsHashable<K>::value)
+        {
+            if (extras == nullptr || extras->cache.empty())
+            {
+                return;
+            }
+            std::vector<TreeNode *> &cache = extras->cache;
+            TreeNode *&slot = cache[std::hash<K>()(node->key) & (cache.size() - 1)];
+            if (slot == node)
+            {
+                slot = nullptr;
+            }
+        }
+    }
+
+    void _ResetCache()
+    {
+        if (extras)
+        {
+            std::fill(extras->cache.begin(), extras->cache.end(), nullptr);
+        }
+    }
+
+    static void _Prefetch(const TreeNode *node)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(node);
+#else
+        (void)node;
+#endif
+    }
+
+    // find key from root,parent is left on the last node visited (where key would hang)
+    TreeNode *_Descend(const K &key, TreeNode *&parent) const
+    {
+        parent = nullptr;
+        TreeNode *current = root;
+        if constexpr (std::is_integral<K>::value)
+        {
+            // one equality test that is almost never taken,the child is picked
+            // by index (no second compare-and-branch) while both are prefetched
+            while (current != nullptr && !(key == current->key))
+            {
+                TreeNode *const child[2] = {current->left, current->right};
+                _Prefetch(child[0]);
+                _Prefetch(child[1]);
+                parent = current;
+                current = child[key > current->key];
+            }
+            return current;
+        }
+        else if constexpr (std::is_same<K, StringKey>::value)
+        {
+            // key shares lowLcp bytes with the last node we went right at and
+            // highLcp bytes with the last node we went left at. every node below
+            // sits between those two,so it shares the smaller prefix with key
+            // as well and comparing can start there
+            std::uint32_t lowLcp = 0;
+            std::uint32_t highLcp = 0;
+            while (current != nullptr)
+            {
+                std::uint32_t lcp;
+                int order = StringKey::Compare(key, current->key, std::min(lowLcp, highLcp), lcp);
+                if (order == 0)
+                {
+                    return current;
+                }
+                parent = current;
+                if (order > 0)
+                {
+                    lowLcp = lcp;
+                    current = current->right;
+                }
+                else
+                {
+                    highLcp = lcp;
+                    current = current->left;
+                }
+            }
+            return nullptr;
+        }
+        else
+        {
+            while (current != nullptr)
+            {
+                if (key > current->key)
+                {
+                    parent = current;
+                    current = current->right;
+                }
+                else if (key < current->key)
+                {
+                    parent = current;
+                    current = current->left;
+                }
+                else
+                {
+                    return current;
+                }
+            }
+            return nullptr;
+        }
+    }
+
+    TreeNode *_Search(const K &key) const
+    {
+        TreeNode *parent;
+        return _Descend(key, parent);
+    }
+
+    // _Search through the front cache when it is enabled
+    TreeNode *_Find(const K &key) const
+    {
+        TreeNode *node = nullptr;
+        if constexpr (_IsHashable<K>::value)
+        {
+            if (extras && !extras->cache.empty())
+            {
+                std::vector<TreeNode *> &cache = extras->cache;
+                TreeNode *&slot = cache[std::hash<K>()(key) & (cache.size() - 1)];
+                if (slot != nullptr && slot->key == key)
+                {
+                    extras->cacheHits++;
+                    node = slot;
+                }
+                else
+                {
+                    extras->cacheMisses++;
+                    node = _Search(key);
+                    if (node != nullptr)
+                    {
+                        slot = node;
+                    }
+                }
+                return (node != nullptr && !node->dead) ? node : nullptr;
+            }
+        }
+        node = _Search(key);
+        return (node != nullptr && !node->dead) ? node : nullptr;
+    }
+
+    // all nodes in key order must already be linked into nodes,
+    // rebuild them into a perfectly balanced tree in O(n)
+    TreeNode *_Build(std::vector<TreeNode *> &nodes, std::size_t lo, std::size_t hi,
+                     TreeNode *parent, int depth, int redDepth)
+    {
+        if (lo >= hi)
+        {
+            return nullptr;
+        }
+        std::size_t mid = lo + (hi - lo) / 2;
+        TreeNode *node = nodes[mid];
+        node->parent = parent;
+        // only the lowest level may be incomplete,make it red
+        node->color = (depth == redDepth) ? Red : Black;
+        node->left = _Build(nodes, lo, mid, node, depth + 1, redDepth);
+        node->right = _Build(nodes, mid + 1, hi, node, depth + 1, redDepth);
+        return node;
+    }
+
+    void _Rebuild(std::vector<TreeNode *> &nodes)
+    {
+        int redDepth = 0;
+        while ((std::size_t(2) << redDepth) <= nodes.size())
+        {
+            redDepth++;
+        }
+        root = _Build(nodes, 0, nodes.size(), nullptr, 0, redDepth);
+        if (root)
+        {
+            root->color = Black;
+        }
+        _ResetBounds();
+    }
+
+    // find leftmost/rightmost again after the nodes were replaced
+    void _ResetBounds()
+    {
+        leftmost = rightmost = root;
+        while (leftmost && leftmost->left)
+        {
+            leftmost = leftmost->left;
+        }
+        while (rightmost && rightmost->right)
+        {
+            rightmost = rightmost->right;
+        }
+    }
+
+    // split/join work on detached subtrees with a black root (or nullptr).
+    // h is a black height: black nodes on a path down from the root,root included.
+    // root is used as the working root while joining,the caller sets it afterwards
+
+    static int _BlackHeight(const TreeNode *node)
+    {
+        int h = 0;
+        for (; node != nullptr; node = node->left)
+        {
+            h += (node->color == Black) ? 1 : 0;
+        }
+        return h;
+    }
+
+    // cut node off its parent as a tree of its own,
+    // h is its black height while still attached
+    static TreeNode *_Cut(TreeNode *node, int h, int &hNode)
+    {
+        hNode = h;
+        if (node)
+        {
+            node->parent = nullptr;
+            if (node->color == Red)
+            {
+                node->color = Black;
+                hNode++;
+            }
+        }
+        return node;
+    }
+
+    // l < pivot < r,returns the joined tree and its black height in h
+    TreeNode *_Join(TreeNode *l, int hl, TreeNode *pivot, TreeNode *r, int hr, int &h)
+    {
+        pivot->parent = nullptr;
+        if (hl == hr)
+        {
+            pivot->left = l;
+            pivot->right = r;
+            if (l)
+            {
+                l->parent = pivot;
+            }
+            if (r)
+            {
+                r->parent = pivot;
+            }
+            pivot->color = Black;
+            h = hl + 1;
+            return pivot;
+        }
+
+        // hang the lower tree into the inner spine of the taller one
+        bool right = hl > hr;
+        TreeNode *top = right ? l : r;
+        TreeNode *low = right ? r : l;
+        int lowH = right ? hr : hl;
+        h = right ? hl : hr;
+
+        // find a black node (or nullptr) as high as the lower tree
+        TreeNode *parent = nullptr;
+        TreeNode *current = top;
+        int currentH = h;
+        while (currentH > lowH || (current && current->color == Red))
+        {
+            currentH -= (current->color == Black) ? 1 : 0;
+            parent = current;
+            current = right ? current->right : current->left;
+        }
+
+        if (right)
+        {
+            pivot->left = current;
+            pivot->right = low;
+            parent->right = pivot;
+        }
+        else
+        {
+            pivot->left = low;
+            pivot->right = current;
+            parent->left = pivot;
+        }
+        if (current)
+        {
+            current->parent = pivot;
+        }
+        if (low)
+        {
+            low->parent = pivot;
+        }
+        pivot->parent = parent;
+        pivot->color = Red;
+
+        root = top;
+        _InsertFixUp(pivot);
+        if (root->color == Red)
+        {
+            root->color = Black;
+            h++;
+        }
+        return root;
+    }
+
+    // keys < key go to l,the others to r
+    void _Split(TreeNode *t, int h, const K &key, TreeNode *&l, int &hl, TreeNode *&r, int &hr)
+    {
+        if (t == nullptr)
+        {
+            l = r = nullptr;
+            hl = hr = 0;
+            return;
+        }
+        int hChild = h - ((t->color == Black) ? 1 : 0);
+        int hLeft, hRight;
+        TreeNode *left = _Cut(t->left, hChild, hLeft);
+        TreeNode *right = _Cut(t->right, hChild, hRight);
+        t->left = t->right = nullptr;
+
+        if (key > t->key)
+        {
+            TreeNode *middle;
+            int hMiddle;
+            _Split(right, hRight, key, middle, hMiddle, r, hr);
+            l = _Join(left, hLeft, t, middle, hMiddle, hl);
+        }
+        else
+        {
+            TreeNode *middle;
+            int hMiddle;
+            _Split(left, hLeft, key, l, hl, middle, hMiddle);
+            r = _Join(middle, hMiddle, t, right, hRight, hr);
+        }
+    }
+
+    // take the largest node out of t,the others go to rest
+    TreeNode *_SplitLast(TreeNode *t, int h, TreeNode *&rest, int &hRest)
+    {
+        int hChild = h - ((t->color == Black) ? 1 : 0);
+        int hLeft;
+        TreeNode *left = _Cut(t->left, hChild, hLeft);
+        t->left = nullptr;
+        if (t->right == nullptr)
+        {
+            rest = left;
+            hRest = hLeft;
+            t->parent = nullptr;
+            return t;
+        }
+        int hRight;
+        TreeNode *right = _Cut(t->right, hChild, hRight);
+        t->right = nullptr;
+
+        TreeNode *middle;
+        int hMiddle;
+        TreeNode *last = _SplitLast(right, hRight, middle, hMiddle);
+        rest = _Join(left, hLeft, t, middle, hMiddle, hRest);
+        return last;
+    }
+
+    // forget the nodes of a subtree leaving the tree,counting them
+    void _ForgetSubtree(TreeNode *node, std::size_t &nodes, std::size_t &dead)
+    {
+        if (node == nullptr)
+        {
+            return;
+        }
+        _Forget(node);
+        nodes++;
+        dead += node->dead ? 1 : 0;
+        _ForgetSubtree(node->left, nodes, dead);
+        _ForgetSubtree(node->right, nodes, dead);
+    }
+
+    // cut lo <= key < hi out with two splits and one join,
+    // the removed nodes go to out or are freed when out is nullptr
+    void _RemoveRange(const K &lo, const K &hi, RBTree *out)
+    {
+        if (root == nullptr || !(lo < hi))
+        {
+            return;
+        }
+        _BeginWrite();
+
+        TreeNode *below, *rest, *range, *above;
+        int hBelow, hRest, hRange, hAbove;
+        _Split(root, _BlackHeight(root), lo, below, hBelow, rest, hRest);
+        _Split(rest, hRest, hi, range, hRange, above, hAbove);
+
+        // below and above meet at the largest node of below
+        TreeNode *joined = above;
+        if (below != nullptr)
+        {
+            TreeNode *last = _SplitLast(below, hBelow, rest, hRest);
+            int hJoined;
+            joined = _Join(rest, hRest, last, above, hAbove, hJoined);
+        }
+        root = joined;
+        if (root)
+        {
+            root->parent = nullptr;
+            root->color = Black;
+        }
+
+        std::size_t removed = 0, removedDead = 0;
+        _ForgetSubtree(range, removed, removedDead);
+        count -= removed;
+        tombstones -= removedDead;
+        _ResetBounds();
+
+        if (out == nullptr)
+        {
+            _Destroy(range);
+            return;
+        }
+        // nodes inside our blocks can't change owner
+        if (blocks.empty())
+        {
+            out->root = range;
+        }
+        else
+        {
+            out->root = _CopyNodes(range, nullptr);
+            _Destroy(range);
+        }
+        out->count = removed;
+        out->tombstones = removedDead;
+        out->_ResetBounds();
+    }
+
+    // copy shape and colors of node,one heap node each
+    static TreeNode *_CopyNodes(const TreeNode *node, TreeNode *parent)
+    {
+        if (node == nullptr)
+        {
+            return nullptr;
+        }
+        TreeNode *copy = new TreeNode(node->key, node->data, node->color);
+        copy->dead = node->dead;
+        copy->parent = parent;
+        copy->left = _CopyNodes(node->left, copy);
+        copy->right = _CopyNodes(node->right, copy);
+        return copy;
+    }
+
+    // in-order successor,nullptr after the last node
+    static TreeNode *_Next(TreeNode *node)
+    {
+        if (node->right)
+        {
+            node = node->right;
+            while (node->left)
+            {
+                node = node->left;
+            }
+            return node;
+        }
+        while (node->parent && node == node->parent->right)
+        {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    // in-order predecessor,nullptr before the first node
+    static TreeNode *_Prev(TreeNode *node)
+    {
+        if (node->left)
+        {
+            node = node->left;
+            while (node->right)
+            {
+                node = node->right;
+            }
+            return node;
+        }
+        while (node->parent && node == node->parent->left)
+        {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    static void _InOrder(TreeNode *node, std::vector<TreeNode *> &out)
+    {
+        if (node == nullptr)
+        {
+            return;
+        }
+        _InOrder(node->left, out);
+        out.push_back(node);
+        _InOrder(node->right, out);
+    }
+
+    // the top height levels under breadth-first index i in van Emde Boas order:
+    // top half first,then every bottom subtree left to right
+    static void _VEBIndex(std::size_t i, int height, const std::vector<std::size_t> &children,
+                          const std::vector<int> &depths, std::vector<std::size_t> &out)
+    {
+        if (height == 1)
+        {
+            out.push_back(i);
+            return;
+        }
+        int top = height / 2;
+        std::size_t first = out.size();
+        _VEBIndex(i, top, children, depths, out);
+
+        // the deepest level of the top half comes out left to right,
+        // its children are the roots of the bottom subtrees
+        std::size_t end = out.size();
+        int deepest = depths[i] + top - 1;
+        std::vector<std::size_t> bottoms;
+        for (std::size_t j = first; j < end; j++)
+        {
+            if (depths[out[j]] != deepest)
+            {
+                continue;
+            }
+            for (std::size_t side = 0; side < 2; side++)
+            {
+                if (children[out[j] << 1 | side] != SIZE_MAX)
+                {
+                    bottoms.push_back(children[out[j] << 1 | side]);
+                }
+            }
+        }
+        for (std::size_t bottom : bottoms)
+        {
+            _VEBIndex(bottom, height - top, children, depths, out);
+        }
+    }
+
+    // breadth-first indices in key order
+    static void _InOrderIndex(const std::vector<std::size_t> &children, std::vector<std::size_t> &out)
+    {
+        std::vector<std::size_t> stack;
+        std::size_t i = 0;
+        while (i != SIZE_MAX || !stack.empty())
+        {
+            while (i != SIZE_MAX)
+            {
+                stack.push_back(i);
+                i = children[i << 1];
+            }
+            i = stack.back();
+            stack.pop_back();
+            out.push_back(i);
+            i = children[i << 1 | 1];
+        }
+    }
+
+    static void _BreadthFirstOrder(TreeNode *node, std::vector<TreeNode *> &out, std::vector<std::size_t> &parents)
+    {
+        if (node == nullptr)
+        {
+            return;
+        }
+        out.push_back(node);
+        parents.push_back(SIZE_MAX);
+        for (std::size_t i = out.size() - 1; i < out.size(); i++)
+        {
+            if (out[i]->left)
+            {
+                out.push_back(out[i]->left);
+                parents.push_back(i << 1);
+            }
+            if (out[i]->right)
+            {
+                out.push_back(out[i]->right);
+                parents.push_back(i << 1 | 1);
+            }
+        }
+    }
+
+    // nodes in layout order. parents[i] is the index of out[i]'s parent shifted left
+    // by one,low bit set for a right child (SIZE_MAX for node itself)
+    static void _Order(TreeNode *node, NodeLayout layout, std::vector<TreeNode *> &out, std::vector<std::size_t> &parents)
+    {
+        _BreadthFirstOrder(node, out, parents);
+        if (layout == NodeLayout::BreadthFirst || out.size() < 2)
+        {
+            return;
+        }
+
+        // the other layouts permute the breadth-first one. working that out on
+        // index arrays walks the scattered nodes only once
+        std::vector<std::size_t> children(out.size() * 2, SIZE_MAX);
+        std::vector<int> depths(out.size(), 0);
+        for (std::size_t i = 1; i < out.size(); i++)
+        {
+            children[parents[i]] = i;
+            depths[i] = depths[parents[i] >> 1] + 1;
+        }
+        std::vector<std::size_t> indices;
+        indices.reserve(out.size());
+        if (layout == NodeLayout::VEB)
+        {
+            _VEBIndex(0, depths.back() + 1, children, depths, indices);
+        }
+        else
+        {
+            _InOrderIndex(children, indices);
+        }
+
+        std::vector<std::size_t> position(out.size());
+        for (std::size_t j = 0; j < indices.size(); j++)
+        {
+            position[indices[j]] = j;
+        }
+        std::vector<TreeNode *> nodes(out.size());
+        std::vector<std::size_t> links(out.size(), SIZE_MAX);
+        for (std::size_t j = 0; j < indices.size(); j++)
+        {
+            std::size_t i = indices[j];
+            nodes[j] = out[i];
+            if (i != 0)
+            {
+                links[j] = position[parents[i] >> 1] << 1 | (parents[i] & 1);
+            }
+        }
+        out.swap(nodes);
+        parents.swap(links);
+    }
+
+    // copy (or move) the nodes in order into one new block,returns the new root.
+    // the copy of order[i] is slot i,so links are wired by index inside the block
+    static TreeNode *_CopyToBlock(const std::vector<TreeNode *> &order, const std::vector<std::size_t> &parents,
+                                  void *&block, bool move = false)
+    {
+        block = ::operator new(order.size() * sizeof(TreeNode));
+        TreeNode *slots = static_cast<TreeNode *>(block);
+
+        TreeNode *newRoot = nullptr;
+        for (std::size_t i = 0; i < order.size(); i++)
+        {
+            TreeNode *node = order[i];
+            TreeNode *copy = move
+                                 ? new (slots + i) TreeNode(std::move(node->key), std::move(node->data), node->color)
+                                 : new (slots + i) TreeNode(node->key, node->data, node->color);
+            copy->pooled = true;
+            copy->dead = node->dead;
+        }
+        for (std::size_t i = 0; i < order.size(); i++)
+        {
+            TreeNode *copy = slots + i;
+            if (parents[i] == SIZE_MAX)
+            {
+                newRoot = copy;
+                continue;
+            }
+            TreeNode *parent = slots + (parents[i] >> 1);
+            copy->parent = parent;
+            if (parents[i] & 1)
+            {
+                parent->right = copy;
+            }
+            else
+            {
+                parent->left = copy;
+            }
+        }
+        return newRoot;
+    }
+
+    void Rotate_L(TreeNode *node)
+    {
+        TreeNode *r = node->right;
+        TreeNode *rl = r->left;
+
+        node->right = rl;
+        if (rl)
+        {
+            rl->parent = node;
+        }
+
+        TreeNode *parent = node->parent;
+
+        r->left = node;
+        node->parent = r;
+
+        // node is root
+        if (parent == nullptr)
+        {
+            root = r;
+            root->parent = nullptr;
+        }
+        else
+        {
+            if (parent->left == node)
+            {
+                parent->left = r;
+            }
+            else
+            {
+                parent->right = r;
+            }
+            r->parent = parent;
+        }
+    }
+
+    void Rotate_R(TreeNode *node)
+    {
+        TreeNode *l = node->left;
+        TreeNode *lr = l->right;
+
+        node->left = lr;
+        if (lr)
+        {
+            lr->parent = node;
+        }
+
+        TreeNode *parent = node->parent;
+
+        l->right = node;
+        node->parent = l;
+
+        // node is root
+        if (parent == nullptr)
+        {
+            root = l;
+            root->parent = nullptr;
+        }
+        else
+        {
+            if (parent->left == node)
+            {
+                parent->left = l;
+            }
+            else
+            {
+                parent->right = l;
+            }
+            l->parent = parent;
+        }
+    }
+
+public:
+    /// @brief a position in the tree.seeks walk up from the last position
+    /// only as far as needed,so nearby keys cost O(log d) instead of O(log n).
+    /// any change not made through this cursor invalidates it
+    class Cursor
+    {
+    private:
+        friend class RBTree;
+
+        RBTree *tree;
+        // nullptr when past the end
+        TreeNode *node;
+
+        Cursor(RBTree *tree, TreeNode *node) : tree(tree), node(node)
+        {
+        }
+
+        void _Check() const
+        {
+            if (node == nullptr)
+            {
+                throw std::runtime_error("Cursor is not on a key");
+            }
+        }
+
+        // step over tombstones
+        void _SkipForward()
+        {
+            while (node && node->dead)
+            {
+                node = _Next(node);
+            }
+        }
+
+        void _SkipBackward()
+        {
+            while (node && node->dead)
+            {
+                node = _Prev(node);
+            }
+        }
+
+        // every write goes through the tree's _BeginWrite. when that moves nodes
+        // (copying shared ones,or giving up a CompactStep relayout),find ours again
+        void _BeginWrite()
+        {
+            if (!tree->shared && !tree->_Stepping())
+            {
+                tree->_BeginWrite();
+                return;
+            }
+            K key = node->key;
+            tree->_BeginWrite();
+            node = nullptr;
+            Seek(key);
+        }
+
+    public:
+        /// @brief is the cursor on a key?
+        bool Valid() const
+        {
+            return node != nullptr;
+        }
+
+        /// @exception runtime_error : cursor is not on a key
+        const K &Key() const
+        {
+            _Check();
+            return node->key;
+        }
+
+        /// @exception runtime_error : cursor is not on a key
+        const V &Value() const
+        {
+            _Check();
+            return node->data;
+        }
+
+        /// @brief move to key,or to the first key after it when key doesn't exist
+        /// @return whether key exists
+        bool Seek(const K &key)
+        {
+            TreeNode *current = node ? node : tree->root;
+            if (current == nullptr)
+            {
+                return false;
+            }
+
+            // climb until key is inside the key range of current's subtree
+            while (true)
+            {
+                TreeNode *up = current;
+                if (key > current->key)
+                {
+                    // first ancestor that current is on the left of
+                    while (up->parent && up == up->parent->right)
+                    {
+                        up = up->parent;
+                    }
+                    up = up->parent;
+                    if (up == nullptr || key < up->key)
+                    {
+                        break;
+                    }
+                }
+                else if (key < current->key)
+                {
+                    // first ancestor that current is on the right of
+                    while (up->parent && up == up->parent->left)
+                    {
+                        up = up->parent;
+                    }
+                    up = up->parent;
+                    if (up == nullptr || key > up->key)
+                    {
+                        break;
+                    }
+                }
+                else // equal
+                {
+                    break;
+                }
+                current = up;
+            }
+
+            // then down as usual
+            TreeNode *last = nullptr;
+            while (current)
+            {
+                last = current;
+                if (key > current->key)
+                {
+                    current = current->right;
+                }
+                else if (key < current->key)
+                {
+                    current = current->left;
+                }
+                else
+                {
+                    node = current;
+                    if (node->dead)
+                    {
+                        _SkipForward();
+                        return false;
+                    }
+                    return true;
+                }
+            }
+            node = (last->key < key) ? _Next(last) : last;
+            _SkipForward();
+            return false;
+        }
+
+        /// @brief move to the smallest key
+        void SeekFirst()
+        {
+            node = tree->leftmost;
+            _SkipForward();
+        }
+
+        /// @brief move to the largest key
+        void SeekLast()
+        {
+            node = tree->rightmost;
+            _SkipBackward();
+        }
+
+        /// @brief move to the next key
+        /// @return whether the cursor is still on a key
+        /// @exception runtime_error : cursor is not on a key
+        bool Next()
+        {
+            _Check();
+            node = _Next(node);
+            _SkipForward();
+            return node != nullptr;
+        }
+
+        /// @brief move to the previous key
+        /// @return whether the cursor is still on a key
+        /// @exception runtime_error : cursor is not on a key
+        bool Prev()
+        {
+            _Check();
+            node = _Prev(node);
+            _SkipBackward();
+            return node != nullptr;
+        }
+
+        /// @brief update the value at the cursor
+        /// @exception runtime_error : cursor is not on a key
+        void Update(const V &value)
+        {
+            _Check();
+            _BeginWrite();
+            node->data = value;
+        }
+
+        /// @brief delete the key at the cursor and move to the next key.
+        /// with lazy delete it only becomes a tombstone,Compact is left to Delete
+        /// @exception runtime_error : cursor is not on a key
+        void Erase()
+        {
+            _Check();
+            _BeginWrite();
+            if (tree->extras && tree->extras->lazyDelete)
+            {
+                node->dead = true;
+                tree->tombstones++;
+                Next();
+                return;
+            }
+            // with 2 children the successor is moved into node
+            TreeNode *next = (node->left && node->right) ? node : _Next(node);
+            tree->_DeleteNode(node);
+            node = next;
+        }
+    };
+
+    RBTree() : root(nullptr)
+    {
+    }
+
+    ~RBTree()
+    {
+        _Clear();
+    }
+
+    RBTree(const RBTree &) = delete;
+    RBTree &operator=(const RBTree &) = delete;
+    RBTree(RBTree &&other) noexcept : root(nullptr)
+    {
+        _Take(other);
+    }
+    RBTree &operator=(RBTree &&other) noexcept
+    {
+        if (this != &other)
+        {
+            Clear();
+            _Take(other);
+        }
+        return *this;
+    }
+
+    /// @brief copy the tree in O(n),keeping shape and colors (no rebalancing)
+    /// @param layout InOrder/VEB put all nodes in one contiguous block
+    RBTree Clone(NodeLayout layout = NodeLayout::Heap) const
+    {
+        if (root == nullptr || layout == NodeLayout::Heap)
+        {
+            return _Copy(_CopyNodes(root, nullptr));
+        }
+        std::vector<TreeNode *> order;
+        std::vector<std::size_t> parents;
+        order.reserve(count);
+        parents.reserve(count);
+        _Order(root, layout, order, parents);
+        void *block = nullptr;
+        RBTree copy = _Copy(_CopyToBlock(order, parents, block));
+        copy.blocks.push_back(block);
+        return copy;
+    }
+
+    /// @brief copy-on-write copy in O(1).
+    /// both trees read the same nodes,the first write on either side copies them
+    RBTree Share()
+    {
+        if (root == nullptr)
+        {
+            return _Copy(nullptr);
+        }
+        _EndStep();
+        if (!shared)
+        {
+            shared = std::make_shared<SharedNodes>(root, std::move(blocks));
+            blocks.clear();
+        }
+        RBTree copy = _Copy(root);
+        copy.shared = shared;
+        return copy;
+    }
+
+    /// @brief is empty
+    bool Empty() const
+    {
+        return count == tombstones;
+    }
+
+    /// @brief number of keys
+    std::size_t Size() const
+    {
+        return count - tombstones;
+    }
+
+    /// @brief smallest key in O(1) (a cursor's SeekFirst gives the value too)
+    /// @exception runtime_error : tree is empty
+    const K &Min() const
+    {
+        TreeNode *node = leftmost;
+        while (node && node->dead)
+        {
+            node = _Next(node);
+        }
+        if (node == nullptr)
+        {
+            throw std::runtime_error("Tree is empty");
+        }
+        return node->key;
+    }
+
+    /// @brief largest key in O(1)
+    /// @exception runtime_error : tree is empty
+    const K &Max() const
+    {
+        TreeNode *node = rightmost;
+        while (node && node->dead)
+        {
+            node = _Prev(node);
+        }
+        if (node == nullptr)
+        {
+            throw std::runtime_error("Tree is empty");
+        }
+        return node->key;
+    }
+
+    /// @brief remove and return the smallest key and its value,no search from root
+    /// @exception runtime_error : tree is empty
+    std::pair<K, V> PopMin()
+    {
+        _BeginWrite();
+        // tombstones in the way are removed for good
+        while (leftmost && leftmost->dead)
+        {
+            _DeleteNode(leftmost);
+        }
+        if (leftmost == nullptr)
+        {
+            throw std::runtime_error("Tree is empty");
+        }
+        TreeNode *node = leftmost;
+        _Forget(node);
+        std::pair<K, V> top(std::move(node->key), std::move(node->data));
+        _DeleteNode(node);
+        return top;
+    }
+
+    /// @brief remove and return the largest key and its value,no search from root
+    /// @exception runtime_error : tree is empty
+    std::pair<K, V> PopMax()
+    {
+        _BeginWrite();
+        while (rightmost && rightmost->dead)
+        {
+            _DeleteNode(rightmost);
+        }
+        if (rightmost == nullptr)
+        {
+            throw std::runtime_error("Tree is empty");
+        }
+        TreeNode *node = rightmost;
+        _Forget(node);
+        std::pair<K, V> top(std::move(node->key), std::move(node->data));
+        _DeleteNode(node);
+        return top;
+    }
+
+    /// @brief number of contiguous node blocks held (Clone/Compact/CompactStep)
+    std::size_t Blocks() const
+    {
+        return blocks.size();
+    }
+
+    /// @brief number of lazily deleted nodes waiting for Compact
+    std::size_t Tombstones() const
+    {
+        return tombstones;
+    }
+
+    /// @brief when enabled,Delete only marks the node as a tombstone and
+    /// Compact removes them in one batch once tombstones exceed threshold of all nodes.
+    /// disabling compacts right away
+    void SetLazyDelete(bool enable, double threshold = 0.25)
+    {
+        _Extras().lazyDelete = enable;
+        extras->compactThreshold = threshold;
+        if (!enable)
+        {
+            Compact();
+        }
+    }
+
+    /// @brief physically remove all tombstones
+    void Compact()
+    {
+        if (tombstones == 0)
+        {
+            return;
+        }
+        _BeginWrite();
+        std::vector<TreeNode *> nodes;
+        nodes.reserve(count);
+        _InOrder(root, nodes);
+
+        // few tombstones: delete them one by one,else rebuild in O(n)
+        std::size_t logCount = 1;
+        while ((std::size_t(1) << logCount) < count)
+        {
+            logCount++;
+        }
+        if (tombstones * logCount < count)
+        {
+            // largest first: a 2-child delete frees the successor,
+            // which is then already done
+            for (auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+            {
+                if ((*it)->dead)
+                {
+                    _DeleteNode(*it);
+                }
+            }
+            return;
+        }
+        std::size_t live = 0;
+        for (TreeNode *node : nodes)
+        {
+            if (node->dead)
+            {
+                _Forget(node);
+                _FreeNode(node);
+            }
+            else
+            {
+                nodes[live++] = node;
+            }
+        }
+        nodes.resize(live);
+        _Rebuild(nodes);
+        count = live;
+        tombstones = 0;
+    }
+
+    /// @brief remove tombstones,then move every node into one new contiguous block
+    /// in layout order (VEB/BreadthFirst keep a descent within few cache lines).
+    /// the tree is logically unchanged,cursors are invalidated
+    void Compact(NodeLayout layout)
+    {
+        Compact();
+        _BeginWrite();
+        if (root == nullptr || layout == NodeLayout::Heap)
+        {
+            return;
+        }
+        std::vector<TreeNode *> order;
+        std::vector<std::size_t> parents;
+        order.reserve(count);
+        parents.reserve(count);
+        _Order(root, layout, order, parents);
+
+        _ResetCache();
+        void *block = nullptr;
+        root = _CopyToBlock(order, parents, block, true);
+        for (TreeNode *node : order)
+        {
+            _FreeNode(node);
+        }
+        _ReleaseBlocks(blocks);
+        blocks.push_back(block);
+        _ResetBounds();
+    }
+
+    /// @brief Compact(NodeLayout::BreadthFirst) a few nodes at a time:
+    /// moves at most budget nodes per call,true once the whole tree is moved.
+    /// any change to the tree in between gives the relayout up (the nodes moved so far
+    /// go back to the heap),the next call starts over.
+    /// cursors are invalidated
+    bool CompactStep(std::size_t budget)
+    {
+        if (!_Stepping())
+        {
+            Compact();
+            _BeginWrite();
+            if (root == nullptr)
+            {
+                return true;
+            }
+            void *block = ::operator new(count * sizeof(TreeNode));
+            blocks.push_back(block);
+            _Extras().stepSlots = static_cast<TreeNode *>(block);
+            extras->stepQueue.reserve(count);
+            extras->stepQueue.push_back(root);
+        }
+
+        Extras &step = *extras;
+        for (; budget > 0 && step.stepHead < step.stepQueue.size(); budget--)
+        {
+            _MoveToSlot(step.stepQueue[step.stepHead++]);
+        }
+        if (step.stepHead < step.stepQueue.size())
+        {
+            return false;
+        }
+
+        // every node is in the last block now
+        void *block = blocks.back();
+        blocks.pop_back();
+        _ReleaseBlocks(blocks);
+        blocks.push_back(block);
+        _ResetStep();
+        return true;
+    }
+
+    /// @brief insert key and value.when key exists,update value
+    void Insert(const K &key, const V &value)
+    {
+        TraceScope<K> trace(_Recorder(), TraceOp::Insert, key);
+        _BeginWrite();
+        _Insert(root, key, value);
+    }
+
+    /// @brief delete,when key can't find,pass
+    void Delete(const K &key)
+    {
+        TraceScope<K> trace(_Recorder(), TraceOp::Delete, key);
+        // a missing key is not worth un-sharing the nodes
+        if (shared)
+        {
+            TreeNode *node = _Search(key);
+            if (node == nullptr || node->dead)
+            {
+                return;
+            }
+        }
+        _BeginWrite();
+        if (extras && extras->lazyDelete)
+        {
+            TreeNode *node = _Search(key);
+            if (node == nullptr || node->dead)
+            {
+                return;
+            }
+            node->dead = true;
+            tombstones++;
+            if (tombstones > extras->compactThreshold * count)
+            {
+                Compact();
+            }
+            return;
+        }
+        try
+        {
+            _Delete(root, key);
+        }
+        catch (const std::exception &e)
+        {
+            // std::cerr << e.what() << '\n';
+        }
+    }
+
+    /// @brief delete every key with lo <= key < hi in O(log n + k),
+    /// cutting the range out with split/join instead of k Deletes
+    void DeleteRange(const K &lo, const K &hi)
+    {
+        _RemoveRange(lo, hi, nullptr);
+    }
+
+    /// @brief like DeleteRange,but the removed keys are returned as a tree
+    RBTree ExtractRange(const K &lo, const K &hi)
+    {
+        RBTree range;
+        _RemoveRange(lo, hi, &range);
+        return range;
+    }
+
+    /// @brief get value on key
+    /// @exception runtime_error : can't find key
+    const V &Get(const K &key) const
+    {
+        TraceScope<K> trace(_Recorder(), TraceOp::Get, key);
+        TreeNode *node = _Find(key);
+        if (node == nullptr)
+        {
+            throw std::runtime_error("Key " + _KeyText(key) + " Not Found");
+        }
+        return node->data;
+    }
+
+    /// @brief whether key exists?
+    bool Contain(const K &key) const
+    {
+        TraceScope<K> trace(_Recorder(), TraceOp::Contain, key);
+        return _Find(key) != nullptr;
+    }
+
+    /// @brief update value on key
+    /// @exception runtime_error : can't find Key
+    void Update(const K &key, const V &value)
+    {
+        TraceScope<K> trace(_Recorder(), TraceOp::Update, key);
+        _BeginWrite();
+        TreeNode *current = _Search(key);
+        if (current != nullptr && !current->dead)
+        {
+            current->data = value;
+            return;
+        }
+        throw std::runtime_error(
+            "Key " + _KeyText(key) + " Not Found For Update");
+    }
+
+    /// @brief delete the whole tree
+    void Clear()
+    {
+        _Clear();
+    }
+
+    /// @brief put a direct-mapped cache of slots entries (rounded up to a power of 2)
+    /// in front of Get/Contain,so a hot key costs one hash probe.
+    /// Get/Contain then write the cache,don't call them from several threads.
+    /// needs std::hash<K>
+    void EnableCache(std::size_t slots)
+    {
+        static_assert(_IsHashable<K>::value, "EnableCache needs std::hash<K>");
+        std::size_t size = 1;
+        while (size < slots)
+        {
+            size <<= 1;
+        }
+        _Extras().cache.assign(size, nullptr);
+    }
+
+    void DisableCache()
+    {
+        if (extras)
+        {
+            std::vector<TreeNode *>().swap(extras->cache);
+        }
+    }
+
+    /// @brief Get/Contain calls answered by the cache
+    std::size_t CacheHits() const
+    {
+        return extras ? extras->cacheHits : 0;
+    }
+
+    /// @brief Get/Contain calls that had to search the tree
+    std::size_t CacheMisses() const
+    {
+        return extras ? extras->cacheMisses : 0;
+    }
+
+    void ResetCacheStats()
+    {
+        if (extras)
+        {
+            extras->cacheHits = extras->cacheMisses = 0;
+        }
+    }
+
+    /// @brief record every Insert/Get/Contain/Update/Delete with its timing,
+    /// nullptr stops recording.the recorder must outlive the recording
+    void SetRecorder(TraceRecorder<K> *recorder)
+    {
+        _Extras().recorder = recorder;
+    }
+
+    /// @brief a cursor on the smallest key
+    Cursor GetCursor()
+    {
+        Cursor cursor(this, nullptr);
+        cursor.SeekFirst();
+        return cursor;
+    }
+
+    /// @brief write the tree to out as the Print view,a Graphviz digraph or
+    /// nested JSON objects,without recursion and without allocating per node.
+    /// a node deeper than maxDepth (root is 0) or past maxNodes is left out.
+    /// Dump reads the nodes while it runs,so writers have to wait for it.
+    /// a Share() copy doesn't avoid that: the next write while the copy is
+    /// alive copies the whole tree (O(n)) instead
+    /// @param displayData show data? if true,Make sure value can be output
+    /// @return how many nodes were written
+    std::size_t Dump(std::ostream &out, DumpFormat format = DumpFormat::Tree, bool displayData = false,
+                     std::size_t maxDepth = SIZE_MAX, std::size_t maxNodes = SIZE_MAX) const
+    {
+        std::size_t written = 0;
+        switch (format)
+        {
+        case DumpFormat::Tree:
+            if (root)
+            {
+                written = _DumpTree(out, displayData, maxDepth, maxNodes);
+            }
+            if (written < count)
+            {
+                out << "... " << count - written << " more nodes\n";
+            }
+            break;
+        case DumpFormat::DOT:
+            written = _DumpDot(out, displayData, maxDepth, maxNodes);
+            if (written < count)
+            {
+                out << "    // " << count - written << " more nodes\n";
+            }
+            out << "}\n";
+            break;
+        case DumpFormat::JSON:
+            written = _DumpJson(out, displayData, maxDepth, maxNodes);
+            break;
+        }
+        out.flush();
+        return written;
+    }
+
+    /// @param displayData show data? if true,Make sure value can be output
+    void Print(bool displayData = false) const
+    {
+        if (root == nullptr)
+        {
+            std::cout << "Tree is empty" << std::endl;
+            return;
+        }
+        std::cout << "Tree Structure:\n";
+        Dump(std::cout, DumpFormat::Tree, displayData);
+    }
+};
+
+/// @brief key-value container that keeps up to N entries in an inline sorted array
+/// (no heap allocation per entry),moves into an RBTree when it grows past N
+/// and back when the tree shrinks to N/2
+/// @tparam K : must have operator> , operator< , operator==
+/// @tparam V : Any
+template <typename K, typename V, std::size_t N = 16>
+class HybridTree
+{
+    static_assert(N > 0, "HybridTree: N must be positive");
+
+private:
+    // only the first size slots are constructed
+    alignas(K) unsigned char keyStorage[N * sizeof(K)];
+    alignas(V) unsigned char valueStorage[N * sizeof(V)];
+    std::size_t size;
+    // not nullptr once grown past N,the array is empty then
+    std::unique_ptr<RBTree<K, V>> tree;
+
+    K *_Keys()
+    {
+        return reinterpret_cast<K *>(keyStorage);
+    }
+    const K *_Keys() const
+    {
+        return reinterpret_cast<const K *>(keyStorage);
+    }
+    V *_Values()
+    {
+        return reinterpret_cast<V *>(valueStorage);
+    }
+    const V *_Values() const
+    {
+        return reinterpret_cast<const V *>(valueStorage);
+    }
+
+    // index of the first key not less than key,a linear scan beats
+    // binary search at these sizes. number keys are counted without an
+    // early exit,which the compiler can vectorize (GCC at -O3)
+    std::size_t _LowerBound(const K &key) const
+    {
+        const K *keys = _Keys();
+        std::size_t i = 0;
+        if constexpr (std::is_arithmetic<K>::value)
+        {
+            for (std::size_t j = 0; j < size; j++)
+            {
+                i += keys[j] < key;
+            }
+        }
+        else
+        {
+            while (i < size && keys[i] < key)
+            {
+                i++;
+            }
+        }
+        return i;
+    }
+
+    bool _Found(std::size_t i, const K &key) const
+    {
+        return i < size && _Keys()[i] == key;
+    }
+
+    void _DestroyArray()
+    {
+        for (std::size_t i = 0; i < size; i++)
+        {
+            _Keys()[i].~K();
+            _Values()[i].~V();
+        }
+        size = 0;
+    }
+
+    // array full: move everything into a tree
+    void _Grow()
+    {
+        tree.reset(new RBTree<K, V>());
+        for (std::size_t i = 0; i < size; i++)
+        {
+            tree->Insert(_Keys()[i], _Values()[i]);
+        }
+        _DestroyArray();
+    }
+
+    // tree small again: move it back into the array
+    void _Shrink()
+    {
+        for (auto cursor = tree->GetCursor(); cursor.Valid(); cursor.Next())
+        {
+            new (_Keys() + size) K(cursor.Key());
+            new (_Values() + size) V(cursor.Value());
+            size++;
+        }
+        tree.reset();
+    }
+
+    void _Take(HybridTree &other)
+    {
+        for (std::size_t i = 0; i < other.size; i++)
+        {
+            new (_Keys() + i) K(std::move(other._Keys()[i]));
+            new (_Values() + i) V(std::move(other._Values()[i]));
+        }
+        size = other.size;
+        other._DestroyArray();
+        tree = std::move(other.tree);
+    }
+
+public:
+    HybridTree() : size(0)
+    {
+    }
+
+    ~HybridTree()
+    {
+        _DestroyArray();
+    }
+
+    HybridTree(const HybridTree &) = delete;
+    HybridTree &operator=(const HybridTree &) = delete;
+    HybridTree(HybridTree &&other) : size(0)
+    {
+        _Take(other);
+    }
+    HybridTree &operator=(HybridTree &&other)
+    {
+        if (this != &other)
+        {
+            Clear();
+            _Take(other);
         }
         return *this;
     }
 
+    /// @brief copy in O(n),a grown tree is copied with RBTree::Clone
+    HybridTree Clone(NodeLayout layout = NodeLayout::Heap) const
+    {
+        HybridTree copy;
+        if (tree)
+        {
+            copy.tree.reset(new RBTree<K, V>(tree->Clone(layout)));
+            return copy;
+        }
+        for (std::size_t i = 0; i < size; i++)
+        {
+            new (copy._Keys() + i) K(_Keys()[i]);
+            new (copy._Values() + i) V(_Values()[i]);
+            copy.size++;
+        }
+        return copy;
+    }
+
     /// @brief is empty
-    bool Empty()
+    bool Empty() const
+    {
+        return tree ? tree->Empty() : size == 0;
+    }
+
+    /// @brief number of keys
+    std::size_t Size() const
     {
-        return root == nullptr;
+        return tree ? tree->Size() : size;
     }
 
     /// @brief insert key and value.when key exists,update value
     void Insert(const K &key, const V &value)
     {
-        _Insert(root, key, value);
+        if (tree)
+        {
+            tree->Insert(key, value);
+            return;
+        }
+        std::size_t i = _LowerBound(key);
+        if (_Found(i, key))
+        {
+            _Values()[i] = value;
+            return;
+        }
+        if (size == N)
+        {
+            _Grow();
+            tree->Insert(key, value);
+            return;
+        }
+        // open slot i by shifting the tail right
+        K *keys = _Keys();
+        V *values = _Values();
+        if (i == size)
+        {
+            new (keys + size) K(key);
+            new (values + size) V(value);
+        }
+        else
+        {
+            new (keys + size) K(std::move(keys[size - 1]));
+            new (values + size) V(std::move(values[size - 1]));
+            std::move_backward(keys + i, keys + size - 1, keys + size);
+            std::move_backward(values + i, values + size - 1, values + size);
+            keys[i] = key;
+            values[i] = value;
+        }
+        size++;
     }
 
     /// @brief delete,when key can't find,pass
     void Delete(const K &key)
     {
-        try
+        if (tree)
         {
-            _Delete(root, key);
+            tree->Delete(key);
+            if (tree->Size() <= N / 2)
+            {
+                _Shrink();
+            }
+            return;
         }
-        catch (const std::exception &e)
+        std::size_t i = _LowerBound(key);
+        if (!_Found(i, key))
         {
-            // std::cerr << e.what() << '\n';
+            return;
+        }
+        K *keys = _Keys();
+        V *values = _Values();
+        std::move(keys + i + 1, keys + size, keys + i);
+        std::move(values + i + 1, values + size, values + i);
+        size--;
+        keys[size].~K();
+        values[size].~V();
+    }
+
+    /// @brief delete every key with lo <= key < hi
+    void DeleteRange(const K &lo, const K &hi)
+    {
+        if (tree)
+        {
+            tree->DeleteRange(lo, hi);
+            if (tree->Size() <= N / 2)
+            {
+                _Shrink();
+            }
+            return;
+        }
+        if (!(lo < hi))
+        {
+            return;
+        }
+        std::size_t first = _LowerBound(lo);
+        std::size_t last = _LowerBound(hi);
+        if (first == last)
+        {
+            return;
+        }
+        K *keys = _Keys();
+        V *values = _Values();
+        std::move(keys + last, keys + size, keys + first);
+        std::move(values + last, values + size, values + first);
+        for (std::size_t i = size - (last - first); i < size; i++)
+        {
+            keys[i].~K();
+            values[i].~V();
+        }
+        size -= last - first;
+    }
+
+    /// @brief smallest key
+    /// @exception runtime_error : tree is empty
+    const K &Min() const
+    {
+        if (tree)
+        {
+            return tree->Min();
+        }
+        if (size == 0)
+        {
+            throw std::runtime_error("Tree is empty");
+        }
+        return _Keys()[0];
+    }
+
+    /// @brief largest key
+    /// @exception runtime_error : tree is empty
+    const K &Max() const
+    {
+        if (tree)
+        {
+            return tree->Max();
+        }
+        if (size == 0)
+        {
+            throw std::runtime_error("Tree is empty");
         }
+        return _Keys()[size - 1];
     }
 
     /// @brief get value on key
     /// @exception runtime_error : can't find key
     const V &Get(const K &key) const
     {
-        TreeNode *current = root;
-        while (current != nullptr)
+        if (tree)
         {
-            if (key > current->key)
-            {
-                current = current->right;
-            }
-            else if (key < current->key)
-            {
-                current = current->left;
-            }
-            else
-            {
-                return current->data;
-            }
+            return tree->Get(key);
+        }
+        std::size_t i = _LowerBound(key);
+        if (!_Found(i, key))
+        {
+            throw std::runtime_error("Key " + _KeyText(key) + " Not Found");
         }
-        throw std::runtime_error("Key " + std::to_string(key) + " Not Found");
+        return _Values()[i];
     }
 
     /// @brief whether key exists?
     bool Contain(const K &key) const
     {
-        TreeNode *current = root;
-        while (current != nullptr)
+        if (tree)
         {
-            if (key > current->key)
-            {
-                current = current->right;
-            }
-            else if (key < current->key)
-            {
-                current = current->left;
-            }
-            else
-            {
-                return true;
-            }
+            return tree->Contain(key);
         }
-        return false;
+        return _Found(_LowerBound(key), key);
     }
 
     /// @brief update value on key
     /// @exception runtime_error : can't find Key
     void Update(const K &key, const V &value)
     {
-        TreeNode *current = root;
-        while (current != nullptr)
+        if (tree)
         {
-            if (key > current->key)
-            {
-                current = current->right;
-            }
-            else if (key < current->key)
-            {
-                current = current->left;
-            }
-            else
-            {
-                current->data = value;
-                return;
-            }
+            tree->Update(key, value);
+            return;
         }
-        throw std::runtime_error(
-            "Key " + std::to_string(key) + " Not Found For Update");
+        std::size_t i = _LowerBound(key);
+        if (!_Found(i, key))
+        {
+            throw std::runtime_error(
+                "Key " + _KeyText(key) + " Not Found For Update");
+        }
+        _Values()[i] = value;
     }
 
-    /// @brief delete the whole tree
+    /// @brief delete everything,back to the inline array
     void Clear()
     {
-        _Clear();
+        tree.reset();
+        _DestroyArray();
     }
 
     /// @param displayData show data? if true,Make sure value can be output
     void Print(bool displayData = false) const
     {
-        if (root == nullptr)
+        if (tree)
         {
-            std::cout << "Tree is empty" << std::endl;
+            tree->Print(displayData);
             return;
         }
-        std::cout << "Tree Structure:" << std::endl;
-        if (displayData)
+        if (size == 0)
         {
-            _PrintWithData(root, false, "");
+            std::cout << "Tree is empty" << std::endl;
+            return;
         }
-        else
+        std::cout << "Inline Array:" << std::endl;
+        for (std::size_t i = 0; i < size; i++)
         {
-            _Print(root, false, "");
+            std::cout << "└──" << _Keys()[i];
+            if (displayData)
+            {
+                std::cout << " [" << _Values()[i] << "]";
+            }
+            std::cout << std::endl;
         }
     }
 };
 
 /// @brief SetTree
 /// @tparam K : must have operator> , operator< , operator==
-template <typename K>
+/// @tparam Tree : the counting tree,RBTree<K, int> or HybridTree<K, int, N> for tiny sets.
+/// with HybridTree,Share/EnableCache/DisableCache/SetRecorder/Dump aren't available
+template <typename K, typename Tree = RBTree<K, int>>
 class SetTree
 {
 private:
-    RBTree<K, int> tree;
+    static constexpr bool OnRBTree = std::is_same<Tree, RBTree<K, int>>::value;
+
+    Tree tree;
+
+    explicit SetTree(Tree &&tree) : tree(std::move(tree))
+    {
+    }
 
 public:
     SetTree() = default;
@@ -803,6 +3067,19 @@ public:
         return *this;
     }
 
+    /// @brief copy the set in O(n),see RBTree::Clone
+    SetTree Clone(NodeLayout layout = NodeLayout::Heap) const
+    {
+        return SetTree(tree.Clone(layout));
+    }
+
+    /// @brief copy-on-write copy in O(1),see RBTree::Share
+    SetTree Share()
+    {
+        static_assert(OnRBTree, "SetTree::Share needs Tree = RBTree<K, int>");
+        return SetTree(tree.Share());
+    }
+
     /// @brief insert the key
     void Insert(const K &key)
     {
@@ -871,6 +3148,12 @@ public:
         tree.Delete(key);
     }
 
+    /// @brief delete every key with lo <= key < hi,see RBTree::DeleteRange
+    void DeleteRange(const K &lo, const K &hi)
+    {
+        tree.DeleteRange(lo, hi);
+    }
+
     /// @brief delete the whole tree
     void Clear()
     {
@@ -883,9 +3166,277 @@ public:
         return tree.Empty();
     }
 
+    /// @brief smallest key in O(1)
+    /// @exception runtime_error : tree is empty
+    const K &Min() const
+    {
+        return tree.Min();
+    }
+
+    /// @brief largest key in O(1)
+    /// @exception runtime_error : tree is empty
+    const K &Max() const
+    {
+        return tree.Max();
+    }
+
+    /// @brief see RBTree::EnableCache
+    void EnableCache(std::size_t slots)
+    {
+        static_assert(OnRBTree, "SetTree::EnableCache needs Tree = RBTree<K, int>");
+        tree.EnableCache(slots);
+    }
+
+    /// @brief record the calls this set makes on its tree,see RBTree::SetRecorder
+    void SetRecorder(TraceRecorder<K> *recorder)
+    {
+        static_assert(OnRBTree, "SetTree::SetRecorder needs Tree = RBTree<K, int>");
+        tree.SetRecorder(recorder);
+    }
+
+    void DisableCache()
+    {
+        static_assert(OnRBTree, "SetTree::DisableCache needs Tree = RBTree<K, int>");
+        tree.DisableCache();
+    }
+
     void Print()
     {
         tree.Print(true);
     }
+
+    /// @brief see RBTree::Dump,data is each key's count
+    std::size_t Dump(std::ostream &out, DumpFormat format = DumpFormat::Tree,
+                     std::size_t maxDepth = SIZE_MAX, std::size_t maxNodes = SIZE_MAX) const
+    {
+        static_assert(OnRBTree, "SetTree::Dump needs Tree = RBTree<K, int>");
+        return tree.Dump(out, format, true, maxDepth, maxNodes);
+    }
 };
 
+/// @brief RBTree for std::string keys such as long paths with shared prefixes.
+/// key bytes are interned into an arena (no heap string per node) and descents
+/// skip the prefix bytes already known to match.
+/// once deleted keys hold more arena bytes than live ones,Delete copies the
+/// live keys into a new arena and frees the old one
+/// @tparam V : Any
+template <typename V>
+class StringTree
+{
+private:
+    typedef RBTree<StringKey, V> Tree;
+
+    static constexpr std::size_t ChunkSize = 64 * 1024;
+
+    Tree tree;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    // bytes used in chunks.back()
+    std::size_t chunkUsed = ChunkSize;
+    // key bytes in the arena still used by the tree,and left behind by Delete
+    std::size_t liveBytes = 0;
+    std::size_t deadBytes = 0;
+
+    static StringKey _View(const std::string &key)
+    {
+        if (key.size() > UINT32_MAX)
+        {
+            throw std::length_error("StringTree: key longer than 4GB");
+        }
+        return StringKey{key.data(), static_cast<std::uint32_t>(key.size())};
+    }
+
+    // copy key into the arena
+    StringKey _Intern(const StringKey &key)
+    {
+        if (key.size == 0)
+        {
+            return StringKey{"", 0};
+        }
+        if (key.size > ChunkSize - chunkUsed)
+        {
+            if (key.size > ChunkSize / 4)
+            {
+                // big keys get a chunk of their own,the chunk being filled stays last
+                std::unique_ptr<char[]> own(new char[key.size]);
+                char *bytes = own.get();
+                std::memcpy(bytes, key.data, key.size);
+                chunks.insert(chunks.empty() ? chunks.end() : chunks.end() - 1, std::move(own));
+                return StringKey{bytes, key.size};
+            }
+            chunks.emplace_back(new char[ChunkSize]);
+            chunkUsed = 0;
+        }
+        char *bytes = chunks.back().get() + chunkUsed;
+        std::memcpy(bytes, key.data, key.size);
+        chunkUsed += key.size;
+        return StringKey{bytes, key.size};
+    }
+
+    // undo the last _Intern of a small key
+    void _Unintern(const StringKey &key)
+    {
+        if (key.size != 0 && key.data + key.size == chunks.back().get() + chunkUsed)
+        {
+            chunkUsed -= key.size;
+        }
+    }
+
+    // copy the keys still in the tree into a new arena and drop the old one,
+    // the bytes don't change so neither does the order
+    void _CompactArena()
+    {
+        std::vector<std::unique_ptr<char[]>> old;
+        old.swap(chunks);
+        chunkUsed = ChunkSize;
+        typename Tree::Cursor cursor = tree.GetCursor();
+        for (cursor.SeekFirst(); cursor.Valid(); cursor.Next())
+        {
+            StringKey &key = const_cast<StringKey &>(cursor.Key());
+            key = _Intern(key);
+        }
+        deadBytes = 0;
+    }
+
+    // move everything out of other,other is left empty and usable
+    void _Take(StringTree &other)
+    {
+        tree = std::move(other.tree);
+        chunks = std::move(other.chunks);
+        chunkUsed = other.chunkUsed;
+        liveBytes = other.liveBytes;
+        deadBytes = other.deadBytes;
+
+        other.chunks.clear();
+        other.chunkUsed = ChunkSize;
+        other.liveBytes = other.deadBytes = 0;
+    }
+
+public:
+    typedef typename Tree::Cursor Cursor;
+
+    StringTree() = default;
+    StringTree(const StringTree &) = delete;
+    StringTree &operator=(const StringTree &) = delete;
+    StringTree(StringTree &&other) noexcept
+    {
+        _Take(other);
+    }
+    StringTree &operator=(StringTree &&other) noexcept
+    {
+        if (this != &other)
+        {
+            _Take(other);
+        }
+        return *this;
+    }
+
+    bool Empty() const
+    {
+        return tree.Empty();
+    }
+
+    std::size_t Size() const
+    {
+        return tree.Size();
+    }
+
+    /// @brief insert,when key exists,update value
+    void Insert(const std::string &key, const V &value)
+    {
+        StringKey view = _View(key);
+        if (view.size > ChunkSize / 4 && tree.Contain(view))
+        {
+            tree.Update(view, value);
+            return;
+        }
+        // copy first and give the bytes back when the key was already there,
+        // so Insert still descends once
+        std::size_t size = tree.Size();
+        StringKey interned = _Intern(view);
+        tree.Insert(interned, value);
+        if (tree.Size() == size)
+        {
+            _Unintern(interned);
+            return;
+        }
+        liveBytes += view.size;
+    }
+
+    /// @brief delete,when key can't find,pass.
+    /// the arena is compacted once deleted keys take more bytes than live ones
+    void Delete(const std::string &key)
+    {
+        StringKey view = _View(key);
+        std::size_t size = tree.Size();
+        tree.Delete(view);
+        if (tree.Size() == size)
+        {
+            return;
+        }
+        liveBytes -= view.size;
+        deadBytes += view.size;
+        if (deadBytes > ChunkSize && deadBytes > liveBytes)
+        {
+            _CompactArena();
+        }
+    }
+
+    /// @brief get value on key
+    /// @exception runtime_error : can't find key
+    const V &Get(const std::string &key) const
+    {
+        return tree.Get(_View(key));
+    }
+
+    /// @brief whether key exists?
+    bool Contain(const std::string &key) const
+    {
+        return tree.Contain(_View(key));
+    }
+
+    /// @brief update value on key
+    /// @exception runtime_error : can't find Key
+    void Update(const std::string &key, const V &value)
+    {
+        tree.Update(_View(key), value);
+    }
+
+    /// @brief delete the whole tree and the arena
+    void Clear()
+    {
+        tree.Clear();
+        chunks.clear();
+        chunkUsed = ChunkSize;
+        liveBytes = 0;
+        deadBytes = 0;
+    }
+
+    /// @brief keys are StringKey views into the arena,valid until Clear or a Delete
+    Cursor GetCursor()
+    {
+        return tree.GetCursor();
+    }
+
+    /// @brief see RBTree::EnableCache
+    void EnableCache(std::size_t slots)
+    {
+        tree.EnableCache(slots);
+    }
+
+    void DisableCache()
+    {
+        tree.DisableCache();
+    }
+
+    void Print(bool displayData)
+    {
+        tree.Print(displayData);
+    }
+
+    /// @brief see RBTree::Dump
+    std::size_t Dump(std::ostream &out, DumpFormat format = DumpFormat::Tree, bool displayData = false,
+                     std::size_t maxDepth = SIZE_MAX, std::size_t maxNodes = SIZE_MAX) const
+    {
+        return tree.Dump(out, format, displayData, maxDepth, maxNodes);
+    }
+};
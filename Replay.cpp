@@ -0,0 +1,265 @@
+#include "RBTree.cpp"
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+// replays a TraceRecorder file against RBTree,SetTree or std::map
+// and reports throughput and latency percentiles.
+// every Get/Contain/Update that finds its key is counted and printed ("found"),
+// so the compiler can't drop the lookups,and the targets can be checked against each other
+// usage: Replay <trace> [rbtree|settree|map|all]
+
+template <typename K>
+struct RBTreeTarget
+{
+    RBTree<K, K> tree;
+    std::uint64_t found = 0;
+
+    const char *Name() const
+    {
+        return "RBTree";
+    }
+
+    void Run(const TraceEvent<K> &event)
+    {
+        switch (event.op)
+        {
+        case TraceOp::Insert:
+            tree.Insert(event.key, event.key);
+            break;
+        case TraceOp::Get:
+            try
+            {
+                found += tree.Get(event.key) == event.key;
+            }
+            catch (const std::exception &e)
+            {
+            }
+            break;
+        case TraceOp::Contain:
+            found += tree.Contain(event.key);
+            break;
+        case TraceOp::Update:
+            try
+            {
+                tree.Update(event.key, event.key);
+                found++;
+            }
+            catch (const std::exception &e)
+            {
+            }
+            break;
+        case TraceOp::Delete:
+            tree.Delete(event.key);
+            break;
+        }
+    }
+};
+
+template <typename K>
+struct SetTreeTarget
+{
+    SetTree<K> tree;
+    std::uint64_t found = 0;
+
+    const char *Name() const
+    {
+        return "SetTree";
+    }
+
+    // a set has no values: Get/Update become Contain
+    void Run(const TraceEvent<K> &event)
+    {
+        switch (event.op)
+        {
+        case TraceOp::Insert:
+            tree.Insert(event.key);
+            break;
+        case TraceOp::Delete:
+            tree.RemoveAll(event.key);
+            break;
+        default:
+            found += tree.Contain(event.key);
+        }
+    }
+};
+
+template <typename K>
+struct MapTarget
+{
+    std::map<K, K> tree;
+    std::uint64_t found = 0;
+
+    const char *Name() const
+    {
+        return "std::map";
+    }
+
+    void Run(const TraceEvent<K> &event)
+    {
+        switch (event.op)
+        {
+        case TraceOp::Insert:
+            tree[event.key] = event.key;
+            break;
+        case TraceOp::Get:
+        {
+            auto it = tree.find(event.key);
+            found += it != tree.end() && it->second == event.key;
+            break;
+        }
+        case TraceOp::Contain:
+            found += tree.find(event.key) != tree.end();
+            break;
+        case TraceOp::Update:
+        {
+            auto it = tree.find(event.key);
+            if (it != tree.end())
+            {
+                it->second = event.key;
+                found++;
+            }
+            break;
+        }
+        case TraceOp::Delete:
+            tree.erase(event.key);
+            break;
+        }
+    }
+};
+
+// found: lookups that found their key,not printed for the recorded run
+void PrintLatencies(const char *name, double seconds, std::vector<std::uint64_t> &latencies,
+                    std::uint64_t found = UINT64_MAX)
+{
+    using namespace std;
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p)
+    {
+        return latencies[min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+    printf("%-10s %12.0f ops/s   p50 %6llu ns   p90 %6llu ns   p99 %6llu ns   p99.9 %7llu ns   max %8llu ns\n",
+           name, seconds > 0 ? latencies.size() / seconds : 0.0,
+           (unsigned long long)percentile(0.5), (unsigned long long)percentile(0.9),
+           (unsigned long long)percentile(0.99), (unsigned long long)percentile(0.999),
+           (unsigned long long)latencies.back());
+    if (found != UINT64_MAX)
+    {
+        printf("%-10s %llu lookups found\n", "", (unsigned long long)found);
+    }
+}
+
+template <typename Target, typename K>
+void Replay(const std::vector<TraceEvent<K>> &events)
+{
+    using namespace std;
+    typedef chrono::steady_clock Clock;
+
+    Target target;
+    vector<uint64_t> latencies;
+    latencies.reserve(events.size());
+
+    Clock::time_point begin = Clock::now();
+    for (const TraceEvent<K> &event : events)
+    {
+        Clock::time_point start = Clock::now();
+        target.Run(event);
+        latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count());
+    }
+    double seconds = chrono::duration<double>(Clock::now() - begin).count();
+    PrintLatencies(target.Name(), seconds, latencies, target.found);
+}
+
+template <typename K>
+int Run(TraceReader &reader, const std::string &target)
+{
+    using namespace std;
+
+    vector<TraceEvent<K>> events;
+    TraceEvent<K> event;
+    while (reader.Next(event))
+    {
+        events.push_back(event);
+    }
+    if (events.empty())
+    {
+        cout << "Trace is empty" << endl;
+        return 0;
+    }
+
+    // how the calls behaved when they were recorded
+    vector<uint64_t> recorded;
+    recorded.reserve(events.size());
+    for (const TraceEvent<K> &e : events)
+    {
+        recorded.push_back(e.duration);
+    }
+    double span = (events.back().start + events.back().duration) / 1e9;
+    cout << events.size() << " calls" << endl;
+    PrintLatencies("recorded", span, recorded);
+
+    if (target == "rbtree" || target == "all")
+    {
+        Replay<RBTreeTarget<K>>(events);
+    }
+    if (target == "settree" || target == "all")
+    {
+        Replay<SetTreeTarget<K>>(events);
+    }
+    if (target == "map" || target == "all")
+    {
+        Replay<MapTarget<K>>(events);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+
+    if (argc < 2)
+    {
+        cerr << "usage: " << argv[0] << " <trace> [rbtree|settree|map|all]" << endl;
+        return 2;
+    }
+    string target = argc > 2 ? argv[2] : "all";
+
+    try
+    {
+        TraceReader reader(argv[1]);
+        bool isSigned = reader.KeyKind() == TraceFormat::Signed;
+        bool isUnsigned = reader.KeyKind() == TraceFormat::Unsigned;
+        switch (reader.KeySize())
+        {
+        case 4:
+            if (isSigned)
+            {
+                return Run<int32_t>(reader, target);
+            }
+            if (isUnsigned)
+            {
+                return Run<uint32_t>(reader, target);
+            }
+            break;
+        case 8:
+            if (isSigned)
+            {
+                return Run<int64_t>(reader, target);
+            }
+            if (isUnsigned)
+            {
+                return Run<uint64_t>(reader, target);
+            }
+            break;
+        }
+        cerr << "Unsupported key type in trace" << endl;
+        return 1;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
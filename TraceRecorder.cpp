@@ -0,0 +1,273 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+
+/// @brief operations a TraceRecorder logs
+enum class TraceOp : std::uint8_t
+{
+    Insert,
+    Get,
+    Contain,
+    Update,
+    Delete
+};
+
+/// @brief one recorded call
+template <typename K>
+struct TraceEvent
+{
+    TraceOp op;
+    K key;
+    // nanoseconds since the first recorded call
+    std::uint64_t start;
+    std::uint64_t duration;
+};
+
+// trace file: "RBTRACE1",key kind,key size,then per call:
+// op,key bytes,start delta from the previous call (varint ns),duration (varint ns)
+struct TraceFormat
+{
+    enum KeyKind : std::uint8_t
+    {
+        Other,
+        Signed,
+        Unsigned,
+        Floating
+    };
+
+    static constexpr const char *Magic = "RBTRACE1";
+    static constexpr std::size_t MagicSize = 8;
+
+    template <typename K>
+    static KeyKind Kind()
+    {
+        if (std::is_floating_point<K>::value)
+        {
+            return Floating;
+        }
+        if (std::is_integral<K>::value)
+        {
+            return std::is_signed<K>::value ? Signed : Unsigned;
+        }
+        return Other;
+    }
+};
+
+/// @brief records tree calls with keys and timings into a compact binary file.
+/// give it to RBTree::SetRecorder,replay the file with Replay.cpp.
+/// not thread-safe,like the tree it records
+/// @tparam K : trivially copyable
+template <typename K>
+class TraceRecorder
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::ofstream out;
+    std::string buffer;
+    Clock::time_point first;
+    Clock::time_point last;
+    bool started;
+
+    void _Varint(std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            buffer.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    static std::uint64_t _Nanoseconds(Clock::duration duration)
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+
+public:
+    /// @exception runtime_error : can't create path
+    explicit TraceRecorder(const std::string &path)
+        : out(path, std::ios::binary | std::ios::trunc), started(false)
+    {
+        static_assert(std::is_trivially_copyable<K>::value,
+                      "TraceRecorder: K must be trivially copyable");
+        if (!out)
+        {
+            throw std::runtime_error("Can't create trace " + path);
+        }
+        buffer.append(TraceFormat::Magic, TraceFormat::MagicSize);
+        buffer.push_back(static_cast<char>(TraceFormat::Kind<K>()));
+        buffer.push_back(static_cast<char>(sizeof(K)));
+    }
+
+    ~TraceRecorder()
+    {
+        Flush();
+    }
+
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+    static Clock::time_point Now()
+    {
+        return Clock::now();
+    }
+
+    void Record(TraceOp op, const K &key, Clock::time_point start, Clock::time_point end)
+    {
+        if (!started)
+        {
+            first = last = start;
+            started = true;
+        }
+        buffer.push_back(static_cast<char>(op));
+        buffer.append(reinterpret_cast<const char *>(&key), sizeof(K));
+        _Varint(start > last ? _Nanoseconds(start - last) : 0);
+        _Varint(_Nanoseconds(end - start));
+        last = start > last ? start : last;
+        if (buffer.size() >= (1 << 16))
+        {
+            Flush();
+        }
+    }
+
+    /// @brief write buffered records to the file
+    void Flush()
+    {
+        out.write(buffer.data(), buffer.size());
+        out.flush();
+        buffer.clear();
+    }
+};
+
+/// @brief times one tree call for a recorder,does nothing without one
+template <typename K>
+class TraceScope
+{
+private:
+    // only trivially copyable keys can be recorded,TraceRecorder's constructor checks that
+    static constexpr bool Recordable = std::is_trivially_copyable<K>::value;
+
+    TraceRecorder<K> *recorder;
+    TraceOp op;
+    // a copy: the call may free the node that owns the caller's key
+    std::optional<typename std::conditional<Recordable, K, char>::type> key;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    TraceScope(TraceRecorder<K> *recorder, TraceOp op, const K &key)
+        : recorder(recorder), op(op)
+    {
+        if constexpr (Recordable)
+        {
+            if (recorder)
+            {
+                this->key.emplace(key);
+                start = TraceRecorder<K>::Now();
+            }
+        }
+    }
+
+    ~TraceScope()
+    {
+        if constexpr (Recordable)
+        {
+            if (recorder)
+            {
+                recorder->Record(op, *key, start, TraceRecorder<K>::Now());
+            }
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+/// @brief reads a file written by TraceRecorder
+class TraceReader
+{
+private:
+    std::ifstream in;
+    TraceFormat::KeyKind kind;
+    std::size_t keySize;
+    std::uint64_t clock;
+
+    bool _Varint(std::uint64_t &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            int byte = in.get();
+            if (byte == EOF)
+            {
+                return false;
+            }
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    /// @exception runtime_error : can't open path or it isn't a trace
+    explicit TraceReader(const std::string &path) : in(path, std::ios::binary), clock(0)
+    {
+        char magic[TraceFormat::MagicSize];
+        if (!in.read(magic, sizeof(magic)) ||
+            std::memcmp(magic, TraceFormat::Magic, sizeof(magic)) != 0)
+        {
+            throw std::runtime_error(path + " is not a trace");
+        }
+        int kindByte = in.get();
+        int sizeByte = in.get();
+        if (sizeByte == EOF)
+        {
+            throw std::runtime_error(path + " is not a trace");
+        }
+        kind = static_cast<TraceFormat::KeyKind>(kindByte);
+        keySize = static_cast<std::size_t>(sizeByte);
+    }
+
+    TraceFormat::KeyKind KeyKind() const
+    {
+        return kind;
+    }
+
+    std::size_t KeySize() const
+    {
+        return keySize;
+    }
+
+    /// @brief read the next call,false at the end (or at a torn last record)
+    /// @exception runtime_error : K doesn't match the recorded key type
+    template <typename K>
+    bool Next(TraceEvent<K> &event)
+    {
+        if (sizeof(K) != keySize || TraceFormat::Kind<K>() != kind)
+        {
+            throw std::runtime_error("Trace key type doesn't match");
+        }
+        int op = in.get();
+        std::uint64_t delta = 0;
+        if (op == EOF ||
+            !in.read(reinterpret_cast<char *>(&event.key), sizeof(K)) ||
+            !_Varint(delta) || !_Varint(event.duration))
+        {
+            return false;
+        }
+        event.op = static_cast<TraceOp>(op);
+        clock += delta;
+        event.start = clock;
+        return true;
+    }
+};
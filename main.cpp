@@ -1,4 +1,6 @@
 #include"RBTree.cpp"
+#include"DurableTree.cpp"
+#include <map>
 void testRBTree(int nodeCount, int seed, int deleteCount = 0, int startIndex = 0)
 {
     using namespace std;
@@ -85,6 +87,370 @@ void testSetTree(int nodeCount, int seed, int deleteCount = 0, int startIndex =
     }
 }
 
+// mix CompactStep with every mutator and compare the tree with std::map
+void testCompactStep(int rounds, int seed)
+{
+    using namespace std;
+
+    RBTree<int, int> tree;
+    map<int, int> expect;
+    mt19937 random(seed);
+    uniform_int_distribution<int> keyDist(0, 499);
+    uniform_int_distribution<int> opDist(0, 12);
+    int errors = 0;
+
+    for (int i = 0; i < 300; i++)
+    {
+        int key = keyDist(random);
+        tree.Insert(key, i);
+        expect[key] = i;
+    }
+    for (int round = 0; round < rounds; round++)
+    {
+        tree.CompactStep(1 + random() % 20);
+        int key = keyDist(random);
+        switch (opDist(random))
+        {
+        case 0:
+            tree.Insert(key, round);
+            expect[key] = round;
+            break;
+        case 1:
+            tree.Delete(key);
+            expect.erase(key);
+            break;
+        case 2:
+            if (expect.count(key))
+            {
+                tree.Update(key, round);
+                expect[key] = round;
+            }
+            break;
+        case 3:
+            if (!expect.empty())
+            {
+                tree.PopMin();
+                expect.erase(expect.begin());
+            }
+            break;
+        case 4:
+            if (!expect.empty())
+            {
+                tree.PopMax();
+                expect.erase(prev(expect.end()));
+            }
+            break;
+        case 5:
+            tree.DeleteRange(key, key + 10);
+            expect.erase(expect.lower_bound(key), expect.lower_bound(key + 10));
+            break;
+        case 6:
+            tree.ExtractRange(key, key + 10);
+            expect.erase(expect.lower_bound(key), expect.lower_bound(key + 10));
+            break;
+        case 7:
+        {
+            auto cursor = tree.GetCursor();
+            cursor.Seek(key);
+            for (int n = 0; cursor.Valid() && n < 5; n++)
+            {
+                expect.erase(cursor.Key());
+                cursor.Erase();
+            }
+            break;
+        }
+        case 8:
+        {
+            auto cursor = tree.GetCursor();
+            cursor.Seek(key);
+            for (int n = 0; cursor.Valid() && n < 5; n++, cursor.Next())
+            {
+                cursor.Update(round);
+                expect[cursor.Key()] = round;
+            }
+            break;
+        }
+        case 9:
+            tree.SetLazyDelete(random() % 2 == 0);
+            break;
+        case 10:
+            tree.Compact();
+            break;
+        case 11:
+        {
+            auto copy = tree.Share();
+            tree.Insert(key, round);
+            expect[key] = round;
+            break;
+        }
+        case 12:
+            if (random() % 20 == 0)
+            {
+                tree.Clear();
+                expect.clear();
+            }
+            break;
+        }
+
+        if (tree.Size() != expect.size())
+        {
+            errors++;
+            cout << "round " << round << ": size " << tree.Size() << " vs " << expect.size() << endl;
+        }
+        // the finished layout's block and the one being filled
+        if (tree.Blocks() > 2)
+        {
+            errors++;
+            cout << "round " << round << ": " << tree.Blocks() << " blocks" << endl;
+        }
+    }
+    while (!tree.CompactStep(7))
+    {
+    }
+
+    auto cursor = tree.GetCursor();
+    auto it = expect.begin();
+    for (cursor.SeekFirst(); cursor.Valid(); cursor.Next(), ++it)
+    {
+        if (it == expect.end() || cursor.Key() != it->first || cursor.Value() != it->second)
+        {
+            errors++;
+            break;
+        }
+    }
+    if (it != expect.end())
+    {
+        errors++;
+    }
+    cout << (errors == 0 ? "ok" : "failed") << endl;
+}
+
+// whether tree holds exactly the keys and values of expect
+bool sameAsMap(RBTree<int, int> &tree, const std::map<int, int> &expect)
+{
+    if (tree.Size() != expect.size())
+    {
+        return false;
+    }
+    auto it = expect.begin();
+    auto cursor = tree.GetCursor();
+    for (cursor.SeekFirst(); cursor.Valid(); cursor.Next(), ++it)
+    {
+        if (it == expect.end() || cursor.Key() != it->first || cursor.Value() != it->second)
+        {
+            return false;
+        }
+    }
+    return it == expect.end() &&
+           (expect.empty() || (tree.Min() == expect.begin()->first && tree.Max() == expect.rbegin()->first));
+}
+
+// DeleteRange/ExtractRange (split/join) at the ends of the tree,on empty ranges
+// and on trees living in a Clone block,compared with std::map
+void testRange(int rounds, int seed)
+{
+    using namespace std;
+
+    mt19937 random(seed);
+    int errors = 0;
+    const NodeLayout layouts[] = {NodeLayout::Heap, NodeLayout::InOrder, NodeLayout::VEB, NodeLayout::BreadthFirst};
+
+    for (int round = 0; round < rounds; round++)
+    {
+        RBTree<int, int> source;
+        map<int, int> expect;
+        int n = random() % 200;
+        for (int i = 0; i < n; i++)
+        {
+            int key = random() % 1000;
+            source.Insert(key, i);
+            expect[key] = i;
+        }
+        const map<int, int> original = expect;
+        RBTree<int, int> tree = source.Clone(layouts[round % 4]);
+
+        for (int op = 0; op < 8; op++)
+        {
+            int lo, hi;
+            switch (random() % 6)
+            {
+            case 0:
+                // from below the smallest key
+                lo = -1 - int(random() % 10);
+                hi = random() % 1000;
+                break;
+            case 1:
+                // up to past the largest key
+                lo = random() % 1000;
+                hi = 1000 + random() % 10;
+                break;
+            case 2:
+                // everything
+                lo = -1;
+                hi = 1000;
+                break;
+            case 3:
+                // empty or reversed
+                lo = random() % 1000;
+                hi = lo - int(random() % 2);
+                break;
+            default:
+                lo = random() % 1000;
+                hi = lo + random() % 100;
+                break;
+            }
+
+            map<int, int> range(expect.lower_bound(lo), lo < hi ? expect.lower_bound(hi) : expect.lower_bound(lo));
+            if (lo < hi)
+            {
+                expect.erase(expect.lower_bound(lo), expect.lower_bound(hi));
+            }
+            if (random() % 2)
+            {
+                tree.DeleteRange(lo, hi);
+            }
+            else
+            {
+                RBTree<int, int> extracted = tree.ExtractRange(lo, hi);
+                if (!sameAsMap(extracted, range))
+                {
+                    errors++;
+                    cout << "round " << round << ": extracted [" << lo << "," << hi << ") differs" << endl;
+                }
+            }
+            if (!sameAsMap(tree, expect))
+            {
+                errors++;
+                cout << "round " << round << ": tree differs after [" << lo << "," << hi << ")" << endl;
+            }
+
+            // the tree stays usable after the split/join
+            int key = random() % 1000;
+            tree.Insert(key, op);
+            expect[key] = op;
+        }
+        // the tree it was cloned from is untouched
+        if (!sameAsMap(source, original))
+        {
+            errors++;
+            cout << "round " << round << ": source changed" << endl;
+        }
+    }
+    cout << (errors == 0 ? "ok" : "failed") << endl;
+}
+
+// whether a DurableTree holds exactly the keys and values of expect
+bool durableSameAsMap(DurableTree<int, int> &tree, const std::map<int, int> &expect)
+{
+    if (tree.Size() != expect.size())
+    {
+        return false;
+    }
+    for (const auto &entry : expect)
+    {
+        if (!tree.Contain(entry.first) || tree.Get(entry.first) != entry.second)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void removeDurable(const std::string &path)
+{
+    for (const char *suffix : {".log", ".log.old", ".ckpt", ".ckpt.tmp", ".log.tmp"})
+    {
+        std::remove((path + suffix).c_str());
+    }
+}
+
+// DurableTree recovery: from a checkpoint plus the log tail,from a log set
+// aside as .log.old by a checkpoint that never finished,and past a torn record
+void testDurable(int seed)
+{
+    using namespace std;
+
+    const string path = "durable_test";
+    DurableOptions options;
+    options.groupCommitDelay = chrono::microseconds(0);
+    options.checkpointEvery = 0;
+    options.checkpointChunk = 64;
+    mt19937 random(seed);
+    map<int, int> expect;
+    int errors = 0;
+
+    auto writeSome = [&](DurableTree<int, int> &tree, int n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            int key = random() % 2000;
+            switch (random() % 3)
+            {
+            case 0:
+            case 1:
+                tree.Insert(key, i);
+                expect[key] = i;
+                break;
+            default:
+                tree.Delete(key);
+                expect.erase(key);
+                break;
+            }
+        }
+    };
+
+    removeDurable(path);
+    // checkpoint plus tail
+    {
+        DurableTree<int, int> tree(path, options);
+        writeSome(tree, 3000);
+        tree.Checkpoint();
+        writeSome(tree, 1000);
+    }
+    {
+        DurableTree<int, int> tree(path, options);
+        if (!durableSameAsMap(tree, expect))
+        {
+            errors++;
+            cout << "checkpoint plus tail differs" << endl;
+        }
+    }
+
+    // a checkpoint that set the log aside and crashed before writing the image:
+    // .log.old ends where .log starts (here they even overlap by a few records)
+    string before = LogFile::ReadAll(path + ".log");
+    {
+        DurableTree<int, int> tree(path, options);
+        writeSome(tree, 1000);
+    }
+    string after = LogFile::ReadAll(path + ".log");
+    string overlap = after.substr(0, before.size() + (after.size() - before.size()) / 2);
+    {
+        ofstream(path + ".log.old", ios::binary | ios::trunc) << overlap;
+        ofstream(path + ".log", ios::binary | ios::trunc) << after.substr(before.size());
+    }
+    // and a torn record at the end
+    {
+        ofstream(path + ".log", ios::binary | ios::app) << string("\x20\0\0\0torn", 8);
+    }
+    for (int open = 0; open < 2; open++)
+    {
+        DurableTree<int, int> tree(path, options);
+        if (!durableSameAsMap(tree, expect))
+        {
+            errors++;
+            cout << "recovery from .log.old differs (open " << open << ")" << endl;
+        }
+        if (ifstream(path + ".log.old"))
+        {
+            errors++;
+            cout << ".log.old left behind" << endl;
+        }
+    }
+    removeDurable(path);
+    cout << (errors == 0 ? "ok" : "failed") << endl;
+}
+
 int main()
 {
     using namespace std;
@@ -99,6 +465,21 @@ int main()
     testSetTree(32, 50, 0);
     cout << endl;
 
+    cout << "CompactStep Test" << endl;
+    cout << "==================================" << endl;
+    testCompactStep(20000, 50);
+    cout << endl;
+
+    cout << "Range Test" << endl;
+    cout << "==================================" << endl;
+    testRange(2000, 50);
+    cout << endl;
+
+    cout << "Durable Test" << endl;
+    cout << "==================================" << endl;
+    testDurable(50);
+    cout << endl;
+
     //system("pause");
     return 0;
 }